@@ -0,0 +1,195 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Asynchronous render API for servers.
+*     RenderQueue* queue = render_queue_create(0);
+*     RenderRequest* r = render_queue_submit(queue, &job, time_now() + 0.050, NULL);
+*     ...
+*     render_request_cancel(r); // the request is stale
+*     ...
+*     while((r = render_queue_poll(queue)) != NULL) // or render_queue_wait
+*     {
+*         if (r->status == RENDER_DONE) ...
+*         render_request_free(r);
+*     }
+* The requests run on a JobPool. The cancel flag and the deadline are checked before the edges are built,
+* after they are sorted, and between the bands of RAST1_TRACE_BAND rows of the sweep,
+* so a dropped request gives its core back within a band.
+* The async path always runs the general sweep, because the fast paths can't stop in the middle.
+*/
+
+static int render_request_stopped(RenderRequest* r)
+{
+    if (atomic_fetch_add_int(&r->cancelled, 0))
+    {
+        r->status = RENDER_CANCELLED;
+        return 1;
+    }
+    if (r->deadline > 0.0 && time_now() > r->deadline)
+    {
+        r->status = RENDER_EXPIRED;
+        return 1;
+    }
+    return 0;
+}
+
+// RowSinkProc into the canvas of the request, stops between the bands
+static int render_request_sink(void* user, int y, const uint8_t* row)
+{
+    RenderRequest* r = (RenderRequest*)user;
+    Canvas* canvas = r->job.canvas;
+    
+    canvas_write_row(canvas, y, row, canvas->w);
+    if ((y + 1) % RAST1_TRACE_BAND == 0)
+        return !render_request_stopped(r);
+    return 1;
+}
+
+static void render_request_proc(void* user, int worker)
+{
+    RenderRequest* r = (RenderRequest*)user;
+    RenderQueue* queue = r->queue;
+    RenderJob* job = &r->job;
+    TRACE_DECL(trace_request);
+    
+    (void)worker;
+    TRACE_BEGIN(trace_request, "render request");
+    
+    if (!render_request_stopped(r))
+    {
+        EdgeInfo info;
+        Edge* edges = edges_alloc_for_raster_from_polygon(&job->polygon, job->scale_x, job->scale_y, job->shift_x, job->shift_y,
+                                                          job->invert, job->vsubsample, &job->edge_count, &info);
+        edges_sort(edges, job->edge_count);
+        
+        if (!render_request_stopped(r) &&
+            rasterize1_sorted_edges_to_sink(job->canvas->w, job->canvas->h, edges, job->edge_count, job->vsubsample, job->fill_rule, render_request_sink, r))
+            r->status = RENDER_DONE;
+        
+        edges_free(edges);
+    }
+    
+    TRACE_END(trace_request);
+    
+    // the request belongs to the caller again once it is on the completion list
+    mutex_lock(&queue->mutex);
+    if (queue->done_tail)
+        queue->done_tail->next_done = r;
+    else
+        queue->done_head = r;
+    queue->done_tail = r;
+    cond_broadcast(&queue->completed);
+    mutex_unlock(&queue->mutex);
+}
+
+// thread_count <= 0 for all the hardware threads. Returns NULL if the threads can't be started.
+RenderQueue* render_queue_create(int thread_count)
+{
+    RenderQueue* queue = (RenderQueue*)SCANLINE_MALLOC(sizeof(RenderQueue));
+    memset(queue, 0, sizeof(*queue));
+    queue->pool = job_pool_create(thread_count);
+    if (queue->pool == NULL)
+    {
+        SCANLINE_FREE(queue);
+        return NULL;
+    }
+    mutex_init(&queue->mutex);
+    cond_init(&queue->completed);
+    return queue;
+}
+
+/*
+* Queue a copy of job, which renders into job->canvas. deadline is in time_now() seconds, or 0 for none.
+* The returned request is the handle for render_request_cancel, and comes back from the completion queue.
+*/
+RenderRequest* render_queue_submit(RenderQueue* queue, const RenderJob* job, double deadline, void* user)
+{
+    RenderRequest* r = (RenderRequest*)SCANLINE_MALLOC(sizeof(RenderRequest));
+    memset(r, 0, sizeof(*r));
+    r->job = *job;
+    r->deadline = deadline;
+    r->user = user;
+    r->status = RENDER_PENDING;
+    r->queue = queue;
+    
+    // the rows are written on a worker, so they are marked here on the thread that owns the canvas
+    canvas_mark_dirty_rows(job->canvas, 0, job->canvas->h);
+    job_pool_submit(queue->pool, render_request_proc, r);
+    return r;
+}
+
+// the request stops at its next check and completes as RENDER_CANCELLED, unless it is already done
+void render_request_cancel(RenderRequest* r)
+{
+    atomic_fetch_add_int(&r->cancelled, 1);
+}
+
+// a finished request, or NULL if none has finished. It doesn't block.
+RenderRequest* render_queue_poll(RenderQueue* queue)
+{
+    RenderRequest* r;
+    mutex_lock(&queue->mutex);
+    r = queue->done_head;
+    if (r)
+    {
+        queue->done_head = r->next_done;
+        if (queue->done_head == NULL)
+            queue->done_tail = NULL;
+        r->next_done = NULL;
+    }
+    mutex_unlock(&queue->mutex);
+    return r;
+}
+
+// wait up to timeout seconds (< 0 for no limit) for a finished request, NULL on timeout
+RenderRequest* render_queue_wait(RenderQueue* queue, double timeout)
+{
+    double end = time_now() + timeout;
+    RenderRequest* r;
+    
+    mutex_lock(&queue->mutex);
+    while(queue->done_head == NULL)
+    {
+        if (timeout < 0.0)
+            cond_wait(&queue->completed, &queue->mutex);
+        else
+        {
+            double left = end - time_now();
+            if (left <= 0.0)
+                break;
+            cond_wait_timeout(&queue->completed, &queue->mutex, left);
+        }
+    }
+    r = queue->done_head;
+    if (r)
+    {
+        queue->done_head = r->next_done;
+        if (queue->done_head == NULL)
+            queue->done_tail = NULL;
+        r->next_done = NULL;
+    }
+    mutex_unlock(&queue->mutex);
+    return r;
+}
+
+// free a request returned by render_queue_poll or render_queue_wait
+void render_request_free(RenderRequest* r)
+{
+    SCANLINE_FREE(r);
+}
+
+// waits for the requests in flight (cancel them first to drop them), and frees the ones never taken
+void render_queue_destroy(RenderQueue* queue)
+{
+    RenderRequest* r;
+    
+    job_pool_wait(queue->pool);
+    job_pool_destroy(queue->pool);
+    
+    while((r = render_queue_poll(queue)) != NULL)
+        render_request_free(r);
+    
+    cond_destroy(&queue->completed);
+    mutex_destroy(&queue->mutex);
+    SCANLINE_FREE(queue);
+}
@@ -0,0 +1,219 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Batch renderer. main -batch jobs.bin [-threads n]
+* Every BatchJob is one polygon rendered into its own canvas and saved by the extension of output.
+* - .png : canvas_save_png with the default options.
+* - .pgm / .raw : the canvas is created on the mapped output file (canvas_create_mapped),
+*   so there is no save step at all.
+* The jobs are independent and run on a work stealing JobPool,
+* so a 100k edge job doesn't hold up the small ones queued behind it.
+* The job file is mapped and validated, and the vertices are used in place.
+*/
+
+typedef struct BatchResult
+{
+    int ok;
+    int edge_count;
+    double seconds;
+} BatchResult;
+
+typedef struct BatchContext
+{
+    const uint8_t* data;
+    size_t size;
+    const BatchJob* jobs;
+    BatchResult* results;
+} BatchContext;
+
+typedef struct BatchTask
+{
+    BatchContext* ctx;
+    int index;
+} BatchTask;
+
+static const char* batch_extension(const char* file_name)
+{
+    const char* dot = strrchr(file_name, '.');
+    return dot ? dot : "";
+}
+
+// returns 0 with a message if the job points outside of the file or has no valid parameters
+static int batch_validate_job(BatchContext* ctx, const BatchJob* job, int index)
+{
+    const char* ext;
+    
+    if (memchr(job->output, 0, sizeof(job->output)) == NULL)
+    {
+        printf("batch job %d : output name is not terminated\n", index);
+        return 0;
+    }
+    if (job->w == 0 || job->h == 0 || job->w > INT32_MAX || job->h > INT32_MAX || job->vsubsample == 0 || job->vsubsample > 255)
+    {
+        printf("batch job %d : invalid size %ux%u or vsubsample %u\n", index, job->w, job->h, job->vsubsample);
+        return 0;
+    }
+    if (job->fill_rule != FILL_NONZERO && job->fill_rule != FILL_EVEN_ODD)
+    {
+        printf("batch job %d : invalid fill rule %u\n", index, job->fill_rule);
+        return 0;
+    }
+    if (job->vertex_count < 3 || job->vertex_count > INT32_MAX || (job->vertex_offset & 3) ||
+        job->vertex_offset > ctx->size || (ctx->size - job->vertex_offset) / sizeof(Vec2) < job->vertex_count)
+    {
+        printf("batch job %d : invalid vertices (%u at %llu)\n", index, job->vertex_count, (unsigned long long)job->vertex_offset);
+        return 0;
+    }
+    
+    ext = batch_extension(job->output);
+    if (job->output[0] && strcmp(ext, ".png") && strcmp(ext, ".pgm") && strcmp(ext, ".raw"))
+    {
+        printf("batch job %d : unknown output format %s\n", index, job->output);
+        return 0;
+    }
+    return 1;
+}
+
+static void batch_run_job(void* user, int worker)
+{
+    BatchTask* task = (BatchTask*)user;
+    BatchContext* ctx = task->ctx;
+    int index = task->index;
+    const BatchJob* job = ctx->jobs + index;
+    BatchResult* result = ctx->results + index;
+    double begin = time_now();
+    const char* ext;
+    RenderJob render;
+    Canvas* canvas;
+    TRACE_DECL(trace_job);
+    
+    result->ok = 0;
+    result->edge_count = 0;
+    result->seconds = 0.0;
+    if (!batch_validate_job(ctx, job, index))
+        return;
+    
+    TRACE_BEGIN_ARG(trace_job, "batch job", index);
+    
+    ext = batch_extension(job->output);
+    if (!strcmp(ext, ".pgm"))
+        canvas = canvas_create_mapped(job->output, (int)job->w, (int)job->h, 1, CANVAS_FILE_PNM);
+    else if (!strcmp(ext, ".raw"))
+        canvas = canvas_create_mapped(job->output, (int)job->w, (int)job->h, 1, CANVAS_FILE_RAW);
+    else
+        canvas = canvas_create((int)job->w, (int)job->h);
+    
+    if (canvas)
+    {
+        render.polygon.count = (int)job->vertex_count;
+        render.polygon.vertices = (Vec2*)(ctx->data + job->vertex_offset); // in place, the mapping is read only
+        render.scale_x = job->scale_x;
+        render.scale_y = job->scale_y;
+        render.shift_x = job->shift_x;
+        render.shift_y = job->shift_y;
+        render.invert = (int)job->invert;
+        render.vsubsample = (int)job->vsubsample;
+        render.fill_rule = (FillRule)job->fill_rule;
+        render.canvas = canvas;
+        render_job_proc(&render, worker);
+        result->edge_count = render.edge_count;
+        
+        if (!strcmp(ext, ".png"))
+            canvas_save_png(canvas, job->output, NULL);
+        canvas_destroy(canvas); // unmaps the .pgm / .raw file
+        result->ok = 1;
+    }
+    else
+        printf("batch job %d : fail to create the canvas %s\n", index, job->output);
+    
+    result->seconds = time_now() - begin;
+    TRACE_END(trace_job);
+}
+
+/*
+* Run every job of the file on thread_count threads (<= 0 for all the hardware threads),
+* and print the aggregate throughput. Returns the number of failed jobs, or -1 if the file is invalid.
+*/
+int batch_run(const char* file_name, int thread_count)
+{
+    MappedFile file;
+    const BatchFileHeader* header;
+    BatchContext ctx;
+    BatchTask* tasks;
+    JobPool* pool;
+    uint64_t pixels = 0, edges = 0;
+    double job_seconds = 0.0, begin, seconds;
+    int failed = 0;
+    
+    if (!mapped_file_open_read(&file, file_name))
+    {
+        printf("Fail to open %s\n", file_name);
+        return -1;
+    }
+    
+    header = (const BatchFileHeader*)file.data;
+    if (file.size < sizeof(BatchFileHeader) || memcmp(header->magic, BATCH_MAGIC, 4) || header->version != BATCH_VERSION ||
+        (header->job_offset & 7) || header->job_offset > file.size ||
+        (file.size - header->job_offset) / sizeof(BatchJob) < header->job_count)
+    {
+        printf("%s is not a batch file of version %d\n", file_name, BATCH_VERSION);
+        mapped_file_close(&file);
+        return -1;
+    }
+    
+    if (thread_count <= 0)
+        thread_count = thread_hardware_count();
+    
+    ctx.data = file.data;
+    ctx.size = file.size;
+    ctx.jobs = (const BatchJob*)(file.data + header->job_offset);
+    ctx.results = (BatchResult*)SCANLINE_MALLOC(sizeof(BatchResult) * (header->job_count ? header->job_count : 1));
+    
+    tasks = (BatchTask*)SCANLINE_MALLOC(sizeof(BatchTask) * (header->job_count ? header->job_count : 1));
+    
+    png_init_tables(); // before the threads
+    
+    begin = time_now();
+    pool = job_pool_create(thread_count);
+    if (pool == NULL)
+        thread_count = 1; // the jobs run here, one after the other
+    for(uint32_t i = 0; i < header->job_count; ++i)
+    {
+        tasks[i].ctx = &ctx;
+        tasks[i].index = (int)i;
+        if (pool)
+            job_pool_submit(pool, batch_run_job, tasks + i);
+        else
+            batch_run_job(tasks + i, 0);
+    }
+    if (pool)
+    {
+        job_pool_wait(pool);
+        job_pool_destroy(pool);
+    }
+    seconds = time_now() - begin;
+    
+    for(uint32_t i = 0; i < header->job_count; ++i)
+    {
+        if (!ctx.results[i].ok)
+        {
+            ++failed;
+            continue;
+        }
+        pixels += (uint64_t)ctx.jobs[i].w * ctx.jobs[i].h;
+        edges += (uint64_t)ctx.results[i].edge_count;
+        job_seconds += ctx.results[i].seconds;
+    }
+    
+    printf("%u jobs (%d failed) on %d threads in %.3f s\n", header->job_count, failed, thread_count, seconds);
+    printf("%.1f jobs/s | %.2f Medges/s | %.2f Mpix/s | %.2f ms per job on a thread\n",
+           seconds > 0.0 ? (header->job_count - failed) / seconds : 0.0,
+           seconds > 0.0 ? edges / seconds * 1e-6 : 0.0,
+           seconds > 0.0 ? pixels / seconds * 1e-6 : 0.0,
+           header->job_count > (uint32_t)failed ? job_seconds / (header->job_count - failed) * 1e3 : 0.0);
+    
+    SCANLINE_FREE(tasks);
+    SCANLINE_FREE(ctx.results);
+    mapped_file_close(&file);
+    return failed;
+}
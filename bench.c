@@ -0,0 +1,378 @@
+/*
+* Benchmark of the edge -> sort -> rasterize -> save pipeline.
+* 
+* usage : bench [-o bench.json] [-t min_seconds_per_workload]
+* 
+* Every workload runs the whole pipeline until it took min_seconds,
+* and each stage is timed separately. The results are printed and written to a JSON file,
+* so two builds can be compared by a script.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#define BENCH_ATOMIC_ADD(p, v) InterlockedExchangeAdd64((volatile LONG64*)(p), (LONG64)(v))
+#else
+#define BENCH_ATOMIC_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#endif
+
+/*
+* NOTE(chan) : count the allocations of every stage.
+* The parallel save allocates on the strip workers, so the counters are added atomically.
+* They are read after the stage, when the workers are joined.
+*/
+static volatile uint64_t bench_alloc_count;
+static volatile uint64_t bench_alloc_bytes;
+
+static void* bench_malloc(size_t size)
+{
+    BENCH_ATOMIC_ADD(&bench_alloc_count, 1);
+    BENCH_ATOMIC_ADD(&bench_alloc_bytes, size);
+    return malloc(size);
+}
+
+static void* bench_realloc(void* p, size_t size)
+{
+    BENCH_ATOMIC_ADD(&bench_alloc_count, 1);
+    BENCH_ATOMIC_ADD(&bench_alloc_bytes, size);
+    return realloc(p, size);
+}
+
+#define SCANLINE_MALLOC(size) bench_malloc(size)
+#define SCANLINE_REALLOC(p, size) bench_realloc(p, size)
+#define SCANLINE_FREE(p) free(p)
+
+#include "scanline.c"
+
+#define BENCH_TEMP_FILE "bench_tmp.png"
+
+typedef enum BenchStageType
+{
+    BENCH_STAGE_EDGE_BUILD,
+    BENCH_STAGE_SORT,
+    BENCH_STAGE_RASTERIZE, // the general sweep, whatever the shape is
+    BENCH_STAGE_RASTERIZE_DISPATCH, // the rasterizer picked from the EdgeInfo (the convex and rectilinear paths)
+    BENCH_STAGE_SAVE,
+    BENCH_STAGE_SAVE_FAST,
+    BENCH_STAGE_SAVE_RLE,
+    BENCH_STAGE_SAVE_STORED,
+    BENCH_STAGE_SAVE_PARALLEL,
+    BENCH_STAGE_SAVE_PNM,
+    BENCH_STAGE_COUNT
+} BenchStageType;
+
+static const char* BENCH_STAGE_NAMES[BENCH_STAGE_COUNT] = {"edge_build", "sort", "rasterize", "rasterize_dispatch", "save", "save_fast", "save_rle", "save_stored", "save_parallel", "save_pnm"};
+
+// the encoder options of the save_ stages after BENCH_STAGE_SAVE (stb_image_write)
+static PngOptions BENCH_PNG_OPTIONS[] = 
+{
+    {PNG_FILTER_UP, PNG_LEVEL_FAST},
+    {PNG_FILTER_SUB, PNG_LEVEL_RLE},
+    {PNG_FILTER_NONE, PNG_LEVEL_STORED},
+};
+
+typedef struct BenchStage
+{
+    double seconds;
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+} BenchStage;
+
+typedef struct BenchWorkload
+{
+    char name[64];
+    Polygon polygon;
+    int w, h;
+    int vsubsample;
+    
+    // results
+    int edge_count;
+    int iterations;
+    BenchStage stages[BENCH_STAGE_COUNT];
+} BenchWorkload;
+
+// NOTE(chan) : our own generator, so the workloads are the same on every platform.
+static uint32_t bench_random_state = 0x12345678;
+
+static float bench_random01(void)
+{
+    bench_random_state = bench_random_state * 1664525u + 1013904223u;
+    return (float)(bench_random_state >> 8) / (float)(1 << 24);
+}
+
+static Polygon bench_polygon_alloc(int count)
+{
+    Polygon p;
+    p.count = count;
+    p.vertices = (Vec2*)malloc(sizeof(Vec2) * count);
+    return p;
+}
+
+static Polygon bench_random_polygon(int count, int w, int h)
+{
+    Polygon p = bench_polygon_alloc(count);
+    for(int i = 0; i < count; ++i)
+    {
+        p.vertices[i].x = bench_random01() * w;
+        p.vertices[i].y = bench_random01() * h;
+    }
+    return p;
+}
+
+static Polygon bench_star(int points, float cx, float cy, float r_outer, float r_inner)
+{
+    Polygon p = bench_polygon_alloc(points * 2);
+    for(int i = 0; i < points * 2; ++i)
+    {
+        float a = 3.14159265f * i / points;
+        float r = (i & 1) ? r_inner : r_outer;
+        p.vertices[i].x = cx + r * sinf(a);
+        p.vertices[i].y = cy - r * cosf(a);
+    }
+    return p;
+}
+
+// a spirograph curve crossing itself many times
+static Polygon bench_self_intersecting(int count, float cx, float cy, float r)
+{
+    Polygon p = bench_polygon_alloc(count);
+    for(int i = 0; i < count; ++i)
+    {
+        float t = 2.f * 3.14159265f * i / count;
+        p.vertices[i].x = cx + r * (0.6f * cosf(t) + 0.4f * cosf(37.f * t));
+        p.vertices[i].y = cy + r * (0.6f * sinf(t) - 0.4f * sinf(37.f * t));
+    }
+    return p;
+}
+
+// a noisy circle like a coastline
+static Polygon bench_outline(int count, float cx, float cy, float r)
+{
+    Polygon p = bench_polygon_alloc(count);
+    for(int i = 0; i < count; ++i)
+    {
+        float t = 2.f * 3.14159265f * i / count;
+        float rr = r * (0.9f + 0.05f * sinf(t * 50.f) + 0.05f * bench_random01());
+        p.vertices[i].x = cx + rr * cosf(t);
+        p.vertices[i].y = cy + rr * sinf(t);
+    }
+    return p;
+}
+
+static void bench_stage_begin(double* t)
+{
+    bench_alloc_count = 0;
+    bench_alloc_bytes = 0;
+    *t = time_now();
+}
+
+static void bench_stage_end(BenchStage* stage, double t)
+{
+    stage->seconds += time_now() - t;
+    stage->alloc_count += bench_alloc_count;
+    stage->alloc_bytes += bench_alloc_bytes;
+}
+
+static void bench_run(BenchWorkload* wl, double min_seconds)
+{
+    Canvas* canvas = canvas_create(wl->w, wl->h);
+    double total = 0.0;
+    
+    memset(wl->stages, 0, sizeof(wl->stages));
+    wl->iterations = 0;
+    
+    while(total < min_seconds || wl->iterations == 0)
+    {
+        EdgeInfo info;
+        Edge* edges;
+        double t;
+        double begin = time_now();
+        
+        bench_stage_begin(&t);
+        edges = edges_alloc_for_raster_from_polygon(&wl->polygon, 1.f, 1.f, 0.f, 0.f, 0, wl->vsubsample, &wl->edge_count, &info);
+        bench_stage_end(wl->stages + BENCH_STAGE_EDGE_BUILD, t);
+        
+        bench_stage_begin(&t);
+        edges_sort(edges, wl->edge_count);
+        bench_stage_end(wl->stages + BENCH_STAGE_SORT, t);
+        
+        bench_stage_begin(&t);
+        canvas_rasterize1_sorted_edges(canvas, edges, wl->edge_count, wl->vsubsample);
+        bench_stage_end(wl->stages + BENCH_STAGE_RASTERIZE, t);
+        
+        bench_stage_begin(&t);
+        canvas_rasterize1_sorted_edges_with_info(canvas, edges, wl->edge_count, wl->vsubsample, &info);
+        bench_stage_end(wl->stages + BENCH_STAGE_RASTERIZE_DISPATCH, t);
+        
+        bench_stage_begin(&t);
+        canvas_save(canvas, BENCH_TEMP_FILE);
+        bench_stage_end(wl->stages + BENCH_STAGE_SAVE, t);
+        
+        for(int k = 0; k < (int)ARRAY_COUNT(BENCH_PNG_OPTIONS); ++k)
+        {
+            bench_stage_begin(&t);
+            canvas_save_png(canvas, BENCH_TEMP_FILE, BENCH_PNG_OPTIONS + k);
+            bench_stage_end(wl->stages + BENCH_STAGE_SAVE_FAST + k, t);
+        }
+        
+        bench_stage_begin(&t);
+        canvas_save_png_parallel(canvas, BENCH_TEMP_FILE, BENCH_PNG_OPTIONS, 0);
+        bench_stage_end(wl->stages + BENCH_STAGE_SAVE_PARALLEL, t);
+        
+        bench_stage_begin(&t);
+        canvas_save_pnm(canvas, BENCH_TEMP_FILE);
+        bench_stage_end(wl->stages + BENCH_STAGE_SAVE_PNM, t);
+        
+        edges_free(edges);
+        
+        total += time_now() - begin;
+        ++wl->iterations;
+    }
+    
+    canvas_destroy(canvas);
+}
+
+static double bench_per_second(double amount, double seconds)
+{
+    return seconds > 0.0 ? amount / seconds : 0.0;
+}
+
+static void bench_print(BenchWorkload* wl)
+{
+    double n = (double)wl->iterations;
+    double pixels = (double)wl->w * wl->h;
+    BenchStage* s = wl->stages;
+    
+    printf("%-24s %7d edges %5dx%-5d vs %2d x%-5d", wl->name, wl->edge_count, wl->w, wl->h, wl->vsubsample, wl->iterations);
+    printf(" | build %8.2f Medges/s | sort %8.2f Medges/s | raster %8.2f Mpix/s (dispatch %.2f) | save %8.2f Mpix/s (fast %.2f, rle %.2f, stored %.2f, parallel %.2f, pnm %.2f) | allocs %.0f/%.0f/%.0f/%.0f\n",
+           bench_per_second(wl->edge_count * n, s[BENCH_STAGE_EDGE_BUILD].seconds) * 1e-6,
+           bench_per_second(wl->edge_count * n, s[BENCH_STAGE_SORT].seconds) * 1e-6,
+           bench_per_second(pixels * n, s[BENCH_STAGE_RASTERIZE].seconds) * 1e-6,
+           bench_per_second(pixels * n, s[BENCH_STAGE_RASTERIZE_DISPATCH].seconds) * 1e-6,
+           bench_per_second(pixels * n, s[BENCH_STAGE_SAVE].seconds) * 1e-6,
+           bench_per_second(pixels * n, s[BENCH_STAGE_SAVE_FAST].seconds) * 1e-6,
+           bench_per_second(pixels * n, s[BENCH_STAGE_SAVE_RLE].seconds) * 1e-6,
+           bench_per_second(pixels * n, s[BENCH_STAGE_SAVE_STORED].seconds) * 1e-6,
+           bench_per_second(pixels * n, s[BENCH_STAGE_SAVE_PARALLEL].seconds) * 1e-6,
+           bench_per_second(pixels * n, s[BENCH_STAGE_SAVE_PNM].seconds) * 1e-6,
+           s[BENCH_STAGE_EDGE_BUILD].alloc_count / n, s[BENCH_STAGE_SORT].alloc_count / n,
+           s[BENCH_STAGE_RASTERIZE].alloc_count / n, s[BENCH_STAGE_SAVE].alloc_count / n);
+}
+
+static void bench_write_json(const char* file_name, BenchWorkload* wls, int count, double min_seconds)
+{
+    FILE* f = fopen(file_name, "w");
+    if (f == NULL)
+    {
+        printf("Fail to write %s\n", file_name);
+        return;
+    }
+    
+    fprintf(f, "{\n");
+    fprintf(f, "  \"sse2\": %d,\n", 
+#ifdef SCANLINE_SSE2
+            1
+#else
+            0
+#endif
+            );
+    fprintf(f, "  \"min_seconds\": %g,\n", min_seconds);
+    fprintf(f, "  \"workloads\": [\n");
+    for(int i = 0; i < count; ++i)
+    {
+        BenchWorkload* wl = wls + i;
+        double n = (double)wl->iterations;
+        double pixels = (double)wl->w * wl->h;
+            
+        fprintf(f, "    {\n");
+        fprintf(f, "      \"name\": \"%s\",\n", wl->name);
+        fprintf(f, "      \"vertices\": %d,\n", wl->polygon.count);
+        fprintf(f, "      \"edges\": %d,\n", wl->edge_count);
+        fprintf(f, "      \"width\": %d,\n", wl->w);
+        fprintf(f, "      \"height\": %d,\n", wl->h);
+        fprintf(f, "      \"vsubsample\": %d,\n", wl->vsubsample);
+        fprintf(f, "      \"iterations\": %d,\n", wl->iterations);
+        fprintf(f, "      \"stages\": {\n");
+        for(int k = 0; k < BENCH_STAGE_COUNT; ++k)
+        {
+            BenchStage* s = wl->stages + k;
+            fprintf(f, "        \"%s\": { \"seconds\": %.9f, \"edges_per_second\": %.1f, \"mpixels_per_second\": %.3f, \"allocations\": %.2f, \"allocated_bytes\": %.0f }%s\n",
+                    BENCH_STAGE_NAMES[k],
+                    s->seconds / n,
+                    bench_per_second(wl->edge_count * n, s->seconds),
+                    bench_per_second(pixels * n, s->seconds) * 1e-6,
+                    s->alloc_count / n,
+                    s->alloc_bytes / n,
+                    k + 1 < BENCH_STAGE_COUNT ? "," : "");
+        }
+        fprintf(f, "      }\n");
+        fprintf(f, "    }%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+    fclose(f);
+}
+
+static void bench_add(BenchWorkload* wls, int* count, const char* name, Polygon p, int w, int h, int vsubsample)
+{
+    BenchWorkload* wl = wls + (*count)++;
+    memset(wl, 0, sizeof(*wl));
+    snprintf(wl->name, sizeof(wl->name), "%s", name);
+    wl->polygon = p;
+    wl->w = w;
+    wl->h = h;
+    wl->vsubsample = vsubsample;
+}
+
+int main(int argc, char** argv)
+{
+    const char* json_name = "bench.json";
+    double min_seconds = 0.5;
+    BenchWorkload wls[32];
+    int count = 0;
+    int glyph_sizes[] = {8, 16, 32, 64, 128};
+    
+    for(int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            json_name = argv[++i];
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            min_seconds = atof(argv[++i]);
+        else
+        {
+            printf("usage : %s [-o bench.json] [-t min_seconds_per_workload]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    bench_add(wls, &count, "random_polygon_64", bench_random_polygon(64, 1024, 1024), 1024, 1024, 4);
+    bench_add(wls, &count, "random_polygon_1k", bench_random_polygon(1000, 1024, 1024), 1024, 1024, 4);
+    bench_add(wls, &count, "star_1000_points", bench_star(1000, 512.f, 512.f, 500.f, 250.f), 1024, 1024, 4);
+    bench_add(wls, &count, "self_intersecting_5k", bench_self_intersecting(5000, 512.f, 512.f, 500.f), 1024, 1024, 4);
+    bench_add(wls, &count, "outline_100k", bench_outline(100000, 1024.f, 1024.f, 1000.f), 2048, 2048, 4);
+    
+    for(int i = 0; i < (int)ARRAY_COUNT(glyph_sizes); ++i)
+    {
+        char name[64];
+        int s = glyph_sizes[i];
+        snprintf(name, sizeof(name), "glyph_%d", s);
+        // NOTE(chan) : stb_truetype uses 15 subsamples below 8 pixels, and 5 otherwise.
+        bench_add(wls, &count, name, bench_star(5, s * 0.5f, s * 0.5f, s * 0.48f, s * 0.2f), s, s, s <= 8 ? 15 : 5);
+    }
+    
+    for(int i = 0; i < count; ++i)
+    {
+        bench_run(wls + i, min_seconds);
+        bench_print(wls + i);
+    }
+    
+    remove(BENCH_TEMP_FILE);
+    bench_write_json(json_name, wls, count, min_seconds);
+    printf("Results are written on %s\n", json_name);
+    
+    for(int i = 0; i < count; ++i)
+        free(wls[i].polygon.vertices);
+    
+    return 0;
+}
@@ -4,6 +4,7 @@ REM setting variables for compile and linking
 cd /D "%~dp0"
 set cl_common= /nologo /FC /Z7
 set cl_debug= call cl /Od %cl_common%
+set cl_release= call cl /O2 %cl_common%
 
 REM prepare build folder
 if not exist build mkdir build
@@ -11,6 +12,7 @@ if not exist build mkdir build
 REM compile and execute the program
 pushd build
 %cl_debug% ..\main.c
+%cl_release% ..\bench.c
 echo "---Compile Done---"
 
 echo "---Clean Previous Results---"
@@ -4,37 +4,569 @@ static CanvasColor CANVAS_C_RED = {255, 0, 0};
 static CanvasColor CANVAS_C_GREEN = {0, 255, 0};
 static CanvasColor CANVAS_C_BLUE = {0, 0, 255};
 
-Canvas* canvas_create(int w, int h)
+Canvas* canvas_create_comp(int w, int h, int comp)
 {
-    int comp = 1; // fix the number of component as 3 for brevity.
-    uint64_t alloc_size = sizeof(Canvas) + w * h * comp;
-    Canvas* canvas = (Canvas*)malloc(alloc_size);
+    // NOTE(chan) : w * h * comp overflows an int beyond 2^31 bytes (a gigapixel canvas),
+    // so the size and the row offsets are 64-bit. See also rasterize1_sorted_edges_out_of_core.
+    uint64_t alloc_size = sizeof(Canvas) + (uint64_t)w * h * comp;
+    Canvas* canvas;
+    if (alloc_size > (uint64_t)SIZE_MAX)
+        return NULL;
+    canvas = (Canvas*)SCANLINE_MALLOC((size_t)alloc_size);
+    if (canvas == NULL)
+        return NULL;
     canvas->p = (uint8_t*)((uint8_t*)canvas + sizeof(Canvas));
     canvas->w = w;
     canvas->h = h;
     canvas->comp = comp;
+    canvas->mapped = NULL;
+    canvas->tiles = NULL;
+    canvas->tiles_x = canvas->tiles_y = 0;
+    canvas->generation = 0;
+    canvas->dirty_count = 0;
     
-    memset(canvas->p, 0, canvas->w * canvas->h * canvas->comp);
+    memset(canvas->p, 0, (size_t)canvas->w * canvas->h * canvas->comp);
     return canvas;
 }
 
+Canvas* canvas_create(int w, int h)
+{
+    return canvas_create_comp(w, h, 1); // fix the number of component as 1 for brevity.
+}
+
 void canvas_destroy(Canvas* canvas)
 {
-    free(canvas);
+    if (canvas->mapped)
+        mapped_file_close(canvas->mapped);
+    if (canvas->tiles)
+    {
+        int dirs = ((canvas->tiles_x + CANVAS_DIR - 1) >> CANVAS_DIR_SHIFT) * ((canvas->tiles_y + CANVAS_DIR - 1) >> CANVAS_DIR_SHIFT);
+        for(int i = 0; i < dirs; ++i)
+        {
+            if (canvas->tiles[i] == NULL)
+                continue;
+            for(int k = 0; k < CANVAS_DIR * CANVAS_DIR; ++k)
+                SCANLINE_FREE(canvas->tiles[i][k].p);
+            SCANLINE_FREE(canvas->tiles[i]);
+        }
+    }
+    SCANLINE_FREE(canvas);
+}
+
+/*
+* NOTE(chan) : Dirty rects, the parts of the canvas changed since the last canvas_clear_dirty.
+* The scene marks what its shapes touch (scene_render, scene_render_dirty) and repaints only the dirty rects,
+* and canvas_save_png_cached encodes only the strips under them. So an update costs what it changes.
+* Every writer of the library marks what it writes : the rasterizers that write whole rows mark the rows
+* (canvas_mark_dirty_rows), the ones that blend over the canvas mark their bounds.
+* The writers don't mark in canvas_pixel / canvas_write_row, because the scene writes through them
+* while it walks the dirty list. So code that writes the pixels itself must call canvas_mark_dirty.
+* The rects are kept disjoint : a new rect absorbs the ones it overlaps or touches.
+* When the list is full, the rect goes into the one whose area grows the least.
+*/
+static int64_t canvas_rect_area(CanvasRect r)
+{
+    return (int64_t)(r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
+static CanvasRect canvas_rect_union(CanvasRect a, CanvasRect b)
+{
+    CanvasRect r;
+    r.x0 = a.x0 < b.x0 ? a.x0 : b.x0;
+    r.y0 = a.y0 < b.y0 ? a.y0 : b.y0;
+    r.x1 = a.x1 > b.x1 ? a.x1 : b.x1;
+    r.y1 = a.y1 > b.y1 ? a.y1 : b.y1;
+    return r;
+}
+
+void canvas_mark_dirty(Canvas* canvas, CanvasRect rect)
+{
+    int merged = 1;
+    
+    if (rect.x0 < 0) rect.x0 = 0;
+    if (rect.y0 < 0) rect.y0 = 0;
+    if (rect.x1 > canvas->w) rect.x1 = canvas->w;
+    if (rect.y1 > canvas->h) rect.y1 = canvas->h;
+    if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1)
+        return;
+    
+    // a union can overlap the rects before it, so merge until nothing changes
+    while(merged)
+    {
+        merged = 0;
+        for(int i = 0; i < canvas->dirty_count; ++i)
+        {
+            CanvasRect d = canvas->dirty[i];
+            if (d.x0 > rect.x1 || rect.x0 > d.x1 || d.y0 > rect.y1 || rect.y0 > d.y1)
+                continue;
+            rect = canvas_rect_union(rect, d);
+            canvas->dirty[i] = canvas->dirty[--canvas->dirty_count];
+            merged = 1;
+            break;
+        }
+        
+        if (!merged && canvas->dirty_count == CANVAS_DIRTY_MAX)
+        {
+            int best = 0;
+            int64_t best_growth = INT64_MAX;
+            for(int i = 0; i < canvas->dirty_count; ++i)
+            {
+                CanvasRect d = canvas->dirty[i];
+                int64_t growth = canvas_rect_area(canvas_rect_union(rect, d)) - canvas_rect_area(d);
+                if (growth < best_growth)
+                {
+                    best = i;
+                    best_growth = growth;
+                }
+            }
+            rect = canvas_rect_union(rect, canvas->dirty[best]);
+            canvas->dirty[best] = canvas->dirty[--canvas->dirty_count];
+            merged = 1;
+        }
+    }
+    canvas->dirty[canvas->dirty_count++] = rect;
+}
+
+// the pixels that the polygon of info can cover, the rows and the columns its bounds go through
+CanvasRect canvas_rect_from_info(const EdgeInfo* info)
+{
+    CanvasRect rect = { 0, 0, 0, 0 };
+    if (info->x0 > info->x1)
+        return rect;
+    rect.x0 = (int)floorf(info->x0);
+    rect.y0 = (int)floorf(info->y0);
+    rect.x1 = (int)floorf(info->x1) + 1;
+    rect.y1 = (int)floorf(info->y1) + 1;
+    return rect;
+}
+
+void canvas_mark_dirty_info(Canvas* canvas, const EdgeInfo* info)
+{
+    canvas_mark_dirty(canvas, canvas_rect_from_info(info));
+}
+
+// the rows [y0, y1) of the whole width, for the writers that write whole rows
+void canvas_mark_dirty_rows(Canvas* canvas, int y0, int y1)
+{
+    CanvasRect rect = { 0, y0, canvas->w, y1 };
+    canvas_mark_dirty(canvas, rect);
+}
+
+void canvas_clear_dirty(Canvas* canvas)
+{
+    canvas->dirty_count = 0;
+}
+
+/*
+* NOTE(chan) : Tiled (sparse) canvas.
+* The pixels are CANVAS_TILE x CANVAS_TILE blocks instead of rows, so a block is 4KB (1 component) in one place,
+* and the rows of a shape or of the compositor stay in the same few pages of the cache and the TLB.
+* Most canvases are labels on a transparent background, so the tiles are allocated on the first write,
+* and the directory is two levels : a block of CANVAS_DIR x CANVAS_DIR tile slots is allocated with its first tile.
+* An empty 100k x 100k canvas is 10k directory pointers instead of 10G bytes.
+* canvas_clear only moves the generation of the canvas, a tile of an older generation reads as zero
+* and is zeroed when it is written again, so a clear doesn't touch the pixels and keeps the memory for the next frame.
+* canvas->p is NULL. The writers go through canvas_row_span / canvas_pixel and canvas_write_row,
+* which are the plain row offsets on a linear canvas. The readers go through canvas_read_row or canvas_linearize,
+* and both skip the empty tiles. The rasterize1 sweep, the paint and the scene write per tile.
+* The convex and rectilinear paths fall back to the sweep, lcd writes its filtered rows with canvas_write_row
+* and the primitives per tile. sdf and the images of paint_image need a linear canvas.
+*/
+Canvas* canvas_create_tiled(int w, int h, int comp)
+{
+    int tiles_x = (w + CANVAS_TILE - 1) >> CANVAS_TILE_SHIFT;
+    int tiles_y = (h + CANVAS_TILE - 1) >> CANVAS_TILE_SHIFT;
+    size_t dirs = (size_t)((tiles_x + CANVAS_DIR - 1) >> CANVAS_DIR_SHIFT) * ((tiles_y + CANVAS_DIR - 1) >> CANVAS_DIR_SHIFT);
+    Canvas* canvas = (Canvas*)SCANLINE_MALLOC(sizeof(Canvas) + sizeof(CanvasTile*) * dirs);
+    if (canvas == NULL)
+        return NULL;
+    canvas->p = NULL;
+    canvas->w = w;
+    canvas->h = h;
+    canvas->comp = comp;
+    canvas->mapped = NULL;
+    canvas->tiles = (CanvasTile**)(canvas + 1);
+    canvas->tiles_x = tiles_x;
+    canvas->tiles_y = tiles_y;
+    canvas->generation = 1;
+    canvas->dirty_count = 0;
+    memset(canvas->tiles, 0, sizeof(CanvasTile*) * dirs);
+    return canvas;
+}
+
+// the slot of the tile (tx, ty), NULL if its directory block isn't allocated and alloc is 0 (or it can't be allocated)
+static CanvasTile* canvas_tile_slot(const Canvas* canvas, int tx, int ty, int alloc)
+{
+    int dirs_x = (canvas->tiles_x + CANVAS_DIR - 1) >> CANVAS_DIR_SHIFT;
+    CanvasTile** dir = canvas->tiles + (size_t)(ty >> CANVAS_DIR_SHIFT) * dirs_x + (tx >> CANVAS_DIR_SHIFT);
+    if (*dir == NULL)
+    {
+        size_t size = sizeof(CanvasTile) * CANVAS_DIR * CANVAS_DIR;
+        if (!alloc)
+            return NULL;
+        *dir = (CanvasTile*)SCANLINE_MALLOC(size);
+        if (*dir == NULL)
+            return NULL;
+        memset(*dir, 0, size);
+    }
+    return *dir + ((ty & (CANVAS_DIR - 1)) << CANVAS_DIR_SHIFT) + (tx & (CANVAS_DIR - 1));
+}
+
+// the pixels of the tile (tx, ty), or NULL if it is empty
+static const uint8_t* canvas_tile_read(const Canvas* canvas, int tx, int ty)
+{
+    const CanvasTile* slot = canvas_tile_slot(canvas, tx, ty, 0);
+    if (slot == NULL || slot->generation != canvas->generation)
+        return NULL;
+    return slot->p;
+}
+
+// the tile of the pixel (x, y), allocated or zeroed if it is empty. NULL if it can't be allocated, then it stays empty.
+static uint8_t* canvas_tile(Canvas* canvas, int x, int y)
+{
+    CanvasTile* slot = canvas_tile_slot(canvas, x >> CANVAS_TILE_SHIFT, y >> CANVAS_TILE_SHIFT, 1);
+    if (slot == NULL)
+        return NULL;
+    if (slot->generation != canvas->generation)
+    {
+        size_t size = (size_t)CANVAS_TILE * CANVAS_TILE * canvas->comp;
+        if (slot->p == NULL)
+            slot->p = (uint8_t*)SCANLINE_MALLOC(size);
+        if (slot->p == NULL)
+            return NULL;
+        memset(slot->p, 0, size);
+        slot->generation = canvas->generation;
+    }
+    return slot->p;
+}
+
+/*
+* Zero the canvas. A tiled canvas starts a new generation, which is O(1)
+* (O(tiles) once every 2^32 clears, when the generation wraps around).
+*/
+void canvas_clear(Canvas* canvas)
+{
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    
+    if (canvas->tiles == NULL)
+    {
+        memset(canvas->p, 0, (size_t)canvas->w * canvas->h * canvas->comp);
+        return;
+    }
+    
+    if (++canvas->generation == 0)
+    {
+        for(int ty = 0; ty < canvas->tiles_y; ++ty)
+        {
+            for(int tx = 0; tx < canvas->tiles_x; ++tx)
+            {
+                CanvasTile* slot = canvas_tile_slot(canvas, tx, ty, 0);
+                if (slot)
+                    slot->generation = 0;
+            }
+        }
+        canvas->generation = 1;
+    }
+}
+
+// the number of pixels from x in the row that are contiguous in memory : to the end of the tile or of the row
+int canvas_row_span(const Canvas* canvas, int x)
+{
+    if (canvas->tiles)
+    {
+        int end = (x | (CANVAS_TILE - 1)) + 1;
+        return (end < canvas->w ? end : canvas->w) - x;
+    }
+    return canvas->w - x;
+}
+
+// the pixel (x, y), and the next canvas_row_span(canvas, x) pixels after it.
+// NULL if the tile of a tiled canvas can't be allocated, and the writers skip those pixels.
+uint8_t* canvas_pixel(Canvas* canvas, int x, int y)
+{
+    if (canvas->tiles)
+    {
+        uint8_t* tile = canvas_tile(canvas, x, y);
+        if (tile == NULL)
+            return NULL;
+        return tile + ((size_t)(y & (CANVAS_TILE - 1)) * CANVAS_TILE + (x & (CANVAS_TILE - 1))) * canvas->comp;
+    }
+    return canvas->p + ((size_t)y * canvas->w + x) * canvas->comp;
+}
+
+static int canvas_is_zero(const uint8_t* p, size_t len)
+{
+    static const uint8_t zero[256] = {0};
+    while(len > sizeof(zero))
+    {
+        if (memcmp(p, zero, sizeof(zero)) != 0)
+            return 0;
+        p += sizeof(zero);
+        len -= sizeof(zero);
+    }
+    return memcmp(p, zero, len) == 0;
+}
+
+/*
+* Copy size bytes to the start of the row y, the way the rasterizers copy a scanline (size is canvas->w).
+* On a tiled canvas, the parts of the empty tiles are skipped if they are all zero.
+*/
+void canvas_write_row(Canvas* canvas, int y, const uint8_t* row, size_t size)
+{
+    size_t tile_bytes = (size_t)CANVAS_TILE * canvas->comp;
+    
+    if (canvas->tiles == NULL)
+    {
+        memcpy(canvas->p + (size_t)y * canvas->w * canvas->comp, row, size);
+        return;
+    }
+    
+    for(size_t offset = 0; offset < size; offset += tile_bytes)
+    {
+        int tx = (int)(offset / tile_bytes);
+        size_t len = size - offset < tile_bytes ? size - offset : tile_bytes;
+        uint8_t* tile;
+        
+        if (canvas_tile_read(canvas, tx, y >> CANVAS_TILE_SHIFT) == NULL && canvas_is_zero(row + offset, len))
+            continue;
+        tile = canvas_tile(canvas, tx << CANVAS_TILE_SHIFT, y);
+        if (tile)
+            memcpy(tile + (size_t)(y & (CANVAS_TILE - 1)) * tile_bytes, row + offset, len);
+    }
+}
+
+/*
+* Copy the row y (w * comp bytes) to row. Returns 0 if the row is empty, then row is zero.
+* zeroed says that row is zero already (the previous row was empty), so an empty row costs nothing.
+*/
+int canvas_read_row(const Canvas* canvas, int y, uint8_t* row, int zeroed)
+{
+    size_t tile_bytes = (size_t)CANVAS_TILE * canvas->comp;
+    int ty = y >> CANVAS_TILE_SHIFT;
+    int filled = 0;
+    
+    if (canvas->tiles == NULL)
+    {
+        memcpy(row, canvas->p + (size_t)y * canvas->w * canvas->comp, (size_t)canvas->w * canvas->comp);
+        return 1;
+    }
+    
+    for(int tx = 0; tx < canvas->tiles_x; ++tx)
+    {
+        const uint8_t* tile = canvas_tile_read(canvas, tx, ty);
+        int x0 = tx << CANVAS_TILE_SHIFT;
+        size_t len = (size_t)canvas_row_span(canvas, x0) * canvas->comp;
+        if (tile)
+        {
+            memcpy(row + (size_t)x0 * canvas->comp, tile + (size_t)(y & (CANVAS_TILE - 1)) * tile_bytes, len);
+            filled = 1;
+        }
+        else if (!zeroed)
+            memset(row + (size_t)x0 * canvas->comp, 0, len);
+    }
+    return filled;
+}
+
+// a linear copy of a tiled canvas, NULL if it can't be allocated. The empty tiles are skipped.
+Canvas* canvas_linearize(const Canvas* canvas)
+{
+    Canvas* linear = canvas_create_comp(canvas->w, canvas->h, canvas->comp);
+    size_t tile_bytes = (size_t)CANVAS_TILE * canvas->comp;
+    size_t stride = (size_t)canvas->w * canvas->comp;
+    
+    if (linear == NULL || canvas->tiles == NULL)
+    {
+        if (linear)
+            memcpy(linear->p, canvas->p, stride * canvas->h);
+        return linear;
+    }
+    
+    for(int ty = 0; ty < canvas->tiles_y; ++ty)
+    {
+        int y0 = ty << CANVAS_TILE_SHIFT;
+        int rows = canvas->h - y0 < CANVAS_TILE ? canvas->h - y0 : CANVAS_TILE;
+        for(int tx = 0; tx < canvas->tiles_x; ++tx)
+        {
+            const uint8_t* tile = canvas_tile_read(canvas, tx, ty);
+            int x0 = tx << CANVAS_TILE_SHIFT;
+            size_t len = (size_t)canvas_row_span(canvas, x0) * canvas->comp;
+            if (tile == NULL)
+                continue; // zero already
+            for(int r = 0; r < rows; ++r)
+                memcpy(linear->p + (size_t)(y0 + r) * stride + (size_t)x0 * canvas->comp, tile + r * tile_bytes, len);
+        }
+    }
+    return linear;
 }
 
 void canvas_save(Canvas* canvas, const char* file_name)
 {
-    int result = stbi_write_png(file_name, canvas->w, canvas->h, canvas->comp, canvas->p, canvas->w * canvas->comp);
+    int result;
+    TRACE_DECL(trace_encode);
+    
+    if (canvas->tiles)
+    {
+        Canvas* linear = canvas_linearize(canvas);
+        if (linear == NULL)
+        {
+            printf("Fail to save a canvas on %s\n", file_name);
+            return;
+        }
+        canvas_save(linear, file_name);
+        canvas_destroy(linear);
+        return;
+    }
+    
+    TRACE_BEGIN(trace_encode, "png encode");
+    result = stbi_write_png(file_name, canvas->w, canvas->h, canvas->comp, canvas->p, canvas->w * canvas->comp);
+    TRACE_END(trace_encode);
     
     if (result == 0)
         printf("Fail to save a canvas on %s\n", file_name);
 }
 
+/*
+* NOTE(chan) : Uncompressed outputs for the intermediate files that don't need PNG.
+* The header is followed by the pixels of canvas->p as they are, so saving is one write,
+* and a canvas can live in a mapped file of the same layout (canvas_create_mapped).
+* Returns the header size, or 0 if the format can't store comp components.
+*/
+static size_t canvas_file_header(char* header, int w, int h, int comp, CanvasFileFormat format)
+{
+    if (format == CANVAS_FILE_RAW)
+    {
+        uint32_t v[3];
+        v[0] = (uint32_t)w;
+        v[1] = (uint32_t)h;
+        v[2] = (uint32_t)comp;
+        memcpy(header, CANVAS_RAW_MAGIC, 4);
+        for(int i = 0; i < 3; ++i)
+        {
+            header[4 + i * 4 + 0] = (char)(v[i] & 0xff);
+            header[4 + i * 4 + 1] = (char)((v[i] >> 8) & 0xff);
+            header[4 + i * 4 + 2] = (char)((v[i] >> 16) & 0xff);
+            header[4 + i * 4 + 3] = (char)((v[i] >> 24) & 0xff);
+        }
+        return CANVAS_RAW_HEADER_SIZE;
+    }
+    
+    if (comp != 1 && comp != 3)
+        return 0;
+    return (size_t)sprintf(header, "%s\n%d %d\n255\n", comp == 1 ? "P5" : "P6", w, h);
+}
+
+static void canvas_save_uncompressed(Canvas* canvas, const char* file_name, CanvasFileFormat format)
+{
+    char header[64];
+    size_t header_size = canvas_file_header(header, canvas->w, canvas->h, canvas->comp, format);
+    size_t size = (size_t)canvas->w * canvas->h * canvas->comp;
+    FILE* f;
+    int ok = 0;
+    TRACE_DECL(trace_save);
+    
+    TRACE_BEGIN(trace_save, "save uncompressed");
+    f = header_size ? fopen(file_name, "wb") : NULL;
+    if (f && canvas->tiles)
+    {
+        // row by row from the tiles, the empty rows write the same zero row
+        size_t row_bytes = (size_t)canvas->w * canvas->comp;
+        uint8_t* row = (uint8_t*)SCANLINE_MALLOC(row_bytes);
+        int zeroed = 0;
+        
+        ok = fwrite(header, 1, header_size, f) == header_size;
+        for(int y = 0; y < canvas->h && ok; ++y)
+        {
+            zeroed = !canvas_read_row(canvas, y, row, zeroed);
+            ok = fwrite(row, 1, row_bytes, f) == row_bytes;
+        }
+        ok = (fclose(f) == 0) && ok;
+        SCANLINE_FREE(row);
+    }
+    else if (f)
+    {
+        ok = fwrite(header, 1, header_size, f) == header_size && fwrite(canvas->p, 1, size, f) == size;
+        ok = (fclose(f) == 0) && ok;
+    }
+    TRACE_END(trace_save);
+    
+    if (!ok)
+        printf("Fail to save a canvas on %s\n", file_name);
+}
+
+// binary PGM for 1 component, PPM for 3 components
+void canvas_save_pnm(Canvas* canvas, const char* file_name)
+{
+    canvas_save_uncompressed(canvas, file_name, CANVAS_FILE_PNM);
+}
+
+void canvas_save_raw(Canvas* canvas, const char* file_name)
+{
+    canvas_save_uncompressed(canvas, file_name, CANVAS_FILE_RAW);
+}
+
+/*
+* NOTE(chan) : A canvas whose pixels are the pixels of an uncompressed file.
+* The file is created with the header and zeroed pixels, and canvas->p points into the mapping,
+* so the rasterizers write the file directly. canvas_save_mapped only flushes the dirty pages,
+* and canvas_destroy unmaps the file. Returns NULL if the file or the canvas can't be created.
+*/
+Canvas* canvas_create_mapped(const char* file_name, int w, int h, int comp, CanvasFileFormat format)
+{
+    char header[64];
+    size_t header_size = canvas_file_header(header, w, h, comp, format);
+    uint64_t size = header_size + (uint64_t)w * h * comp;
+    Canvas* canvas;
+    MappedFile* mapped;
+    
+    if (header_size == 0 || size > (uint64_t)SIZE_MAX)
+        return NULL;
+    
+    canvas = (Canvas*)SCANLINE_MALLOC(sizeof(Canvas) + sizeof(MappedFile));
+    if (canvas == NULL)
+        return NULL;
+    mapped = (MappedFile*)(canvas + 1);
+    if (!mapped_file_create(mapped, file_name, (size_t)size))
+    {
+        SCANLINE_FREE(canvas);
+        return NULL;
+    }
+    
+    memcpy(mapped->data, header, header_size);
+    canvas->p = mapped->data + header_size;
+    canvas->w = w;
+    canvas->h = h;
+    canvas->comp = comp;
+    canvas->mapped = mapped;
+    canvas->tiles = NULL;
+    canvas->tiles_x = canvas->tiles_y = 0;
+    canvas->generation = 0;
+    canvas->dirty_count = 0;
+    return canvas;
+}
+
+// returns 0 if the canvas isn't mapped or the pages couldn't be written
+int canvas_save_mapped(Canvas* canvas)
+{
+    int ok;
+    TRACE_DECL(trace_save);
+    
+    if (canvas->mapped == NULL)
+        return 0;
+    
+    TRACE_BEGIN(trace_save, "save mapped");
+    ok = mapped_file_flush(canvas->mapped);
+    TRACE_END(trace_save);
+    return ok;
+}
+
 void canvas_fill_color_rgb(Canvas* canvas, int x, int y, uint8_t r, uint8_t g, uint8_t b)
 {
-    uint8_t* target = canvas->p + canvas->w * canvas->comp * y + canvas->comp * x;
+    uint8_t* target = canvas_pixel(canvas, x, y);
+    CanvasRect rect = { x, y, x + 1, y + 1 };
     
+    if (target == NULL)
+        return;
+    canvas_mark_dirty(canvas, rect);
     target[0] = r;
     target[1] = g;
     target[2] = b;
@@ -42,8 +574,12 @@ void canvas_fill_color_rgb(Canvas* canvas, int x, int y, uint8_t r, uint8_t g, u
 
 void canvas_fill_color(Canvas* canvas, int x, int y, CanvasColor color)
 {
-    uint8_t* target = canvas->p + canvas->w * canvas->comp * y + canvas->comp * x;
+    uint8_t* target = canvas_pixel(canvas, x, y);
+    CanvasRect rect = { x, y, x + 1, y + 1 };
     
+    if (target == NULL)
+        return;
+    canvas_mark_dirty(canvas, rect);
     target[0] = color.r;
     target[1] = color.g;
     target[2] = color.b;
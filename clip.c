@@ -0,0 +1,249 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Clip masks.
+*     ClipMask* clip = clip_mask_create(w, h, clip_edges, clip_count, 5, FILL_NONZERO);
+*     canvas_rasterize1_sorted_edges_clipped(canvas, edges, edge_count, 5, FILL_NONZERO, clip);
+*     clip_mask_destroy(clip);
+* Clipping used to be a render of the clip path into a temporary canvas, and a multiply of the two canvases.
+* Here the clip path goes through the same sweep, but every row is stored as spans:
+* runs of pixels fully inside (no bytes), and runs of partial coverage on the boundary (their coverage bytes).
+* A clip is a few spans per row and its boundary, instead of w x h bytes.
+* The clipped sweep skips the fill work of a row without spans, and gives the pixels between the spans
+* to rast1_fill_active_occluded as the hidden span list. Then only the boundary spans are multiplied.
+*/
+
+// returns 0 if the spans or the mask can't grow, then the clip is unchanged
+static int clip_mask_push_span(ClipMask* clip, int x0, int x1, const uint8_t* coverage)
+{
+    ClipSpan* span;
+    size_t len = (size_t)(x1 - x0);
+    
+    if (clip->span_count == clip->span_capacity)
+    {
+        int capacity = clip->span_capacity ? clip->span_capacity * 2 : 256;
+        ClipSpan* spans = (ClipSpan*)SCANLINE_REALLOC(clip->spans, sizeof(ClipSpan) * capacity);
+        if (spans == NULL)
+            return 0;
+        clip->spans = spans;
+        clip->span_capacity = capacity;
+    }
+    
+    if (coverage && clip->mask_size + len > clip->mask_capacity)
+    {
+        size_t capacity = clip->mask_capacity;
+        uint8_t* mask;
+        while(clip->mask_size + len > capacity)
+            capacity = capacity ? capacity * 2 : 4096;
+        mask = (uint8_t*)SCANLINE_REALLOC(clip->mask, capacity);
+        if (mask == NULL)
+            return 0;
+        clip->mask = mask;
+        clip->mask_capacity = capacity;
+    }
+    
+    span = clip->spans + clip->span_count++;
+    span->x0 = x0;
+    span->x1 = x1;
+    span->mask = CLIP_SPAN_FULL;
+    
+    if (coverage)
+    {
+        memcpy(clip->mask + clip->mask_size, coverage, len);
+        span->mask = clip->mask_size;
+        clip->mask_size += len;
+    }
+    return 1;
+}
+
+// RowSinkProc of the clip path, a row of coverage to spans
+static int clip_mask_sink(void* user, int y, const uint8_t* row)
+{
+    ClipMask* clip = (ClipMask*)user;
+    int x = 0;
+    
+    clip->rows[y] = clip->span_count;
+    while(x < clip->w)
+    {
+        int begin;
+        if (row[x] == 0)
+        {
+            ++x;
+            continue;
+        }
+        
+        begin = x;
+        if (row[x] == clip->full)
+        {
+            while(x < clip->w && row[x] == clip->full)
+                ++x;
+            if (!clip_mask_push_span(clip, begin, x, NULL))
+                return 0;
+        }
+        else
+        {
+            while(x < clip->w && row[x] != 0 && row[x] != clip->full)
+                ++x;
+            if (!clip_mask_push_span(clip, begin, x, row + begin))
+                return 0;
+        }
+    }
+    clip->rows[y + 1] = clip->span_count;
+    return 1;
+}
+
+void clip_mask_destroy(ClipMask* clip)
+{
+    SCANLINE_FREE(clip->rows);
+    SCANLINE_FREE(clip->spans);
+    SCANLINE_FREE(clip->mask);
+    SCANLINE_FREE(clip);
+}
+
+/*
+* Rasterize the sorted edges of a clip path over w x h pixels.
+* Inside the clip means the full coverage of vsubsample, so a shape keeps its coverage there.
+* Returns NULL if the mask can't be allocated.
+*/
+ClipMask* clip_mask_create(int w, int h, Edge* e, int edge_count, int vsubsample, FillRule rule)
+{
+    ClipMask* clip = (ClipMask*)SCANLINE_MALLOC(sizeof(ClipMask));
+    int ok;
+    TRACE_DECL(trace_clip);
+    
+    if (clip == NULL)
+        return NULL;
+    memset(clip, 0, sizeof(*clip));
+    clip->w = w;
+    clip->h = h;
+    clip->full = (255 / vsubsample) * vsubsample;
+    clip->rows = (int*)SCANLINE_MALLOC(sizeof(int) * (h + 1));
+    if (clip->rows == NULL)
+    {
+        SCANLINE_FREE(clip);
+        return NULL;
+    }
+    clip->rows[0] = 0;
+    
+    TRACE_BEGIN(trace_clip, "clip mask");
+    ok = rasterize1_sorted_edges_to_sink(w, h, e, edge_count, vsubsample, rule, clip_mask_sink, clip);
+    TRACE_END(trace_clip);
+    
+    if (!ok)
+    {
+        clip_mask_destroy(clip);
+        return NULL;
+    }
+    return clip;
+}
+
+/*
+* rasterize1_sorted_edges_to_sink inside the clip. The rows and the pixels out of the clip are 0,
+* and the pixels on the boundary of the clip are scaled by its coverage.
+* Returns 0 if the sink stopped it or the hidden span list can't be allocated.
+*/
+int rasterize1_sorted_edges_clipped_to_sink(int w, int h, Edge* e, int edge_count, int vsubsample, FillRule rule, const ClipMask* clip, RowSinkProc sink, void* user)
+{
+    Heap* hh = &g_rast1_scratch.heap;
+    int y = 0;
+    int max_weight = 255 / vsubsample;
+    ActiveEdge* active = NULL;
+    Edge* sentinel = e + edge_count;
+    uint8_t* scanline = rast1_scratch_row(&g_rast1_scratch, w);
+    int* hidden = (int*)SCANLINE_MALLOC(sizeof(int) * 4);
+    int hidden_capacity = 4;
+    int j;
+    TRACE_DECL(trace_clipped);
+    
+    if (hidden == NULL)
+        return 0;
+    
+    TRACE_BEGIN(trace_clipped, "rasterize clipped");
+    
+    for(j = 0; j < h; ++j)
+    {
+        const ClipSpan* spans = NULL;
+        int span_count = 0;
+        
+        if (j < clip->h)
+        {
+            spans = clip->spans + clip->rows[j];
+            span_count = clip->rows[j + 1] - clip->rows[j];
+        }
+        
+        memset(scanline, 0, w);
+        if (span_count == 0)
+        {
+            // clipped out, the active edges only move to the next row
+            for(int s = 0; s < vsubsample; ++s, ++y)
+                rast1_update_active(hh, &active, &e, sentinel, y + 0.5f);
+            STATS_ADD(rows_skipped, 1);
+        }
+        else
+        {
+            int hidden_count = 0;
+            int x = 0;
+            
+            // the gaps between the spans, and after the last one
+            if (2 * (span_count + 1) > hidden_capacity)
+            {
+                int* grown = (int*)SCANLINE_REALLOC(hidden, sizeof(int) * 2 * (span_count + 1));
+                if (grown == NULL)
+                    break; // the rows from j are left out, and 0 is returned
+                hidden = grown;
+                hidden_capacity = 2 * (span_count + 1);
+            }
+            for(int i = 0; i < span_count; ++i)
+            {
+                if (spans[i].x0 > x)
+                {
+                    hidden[2 * hidden_count] = x;
+                    hidden[2 * hidden_count + 1] = spans[i].x0;
+                    ++hidden_count;
+                }
+                x = spans[i].x1;
+            }
+            if (x < w)
+            {
+                hidden[2 * hidden_count] = x;
+                hidden[2 * hidden_count + 1] = w;
+                ++hidden_count;
+            }
+            
+            for(int s = 0; s < vsubsample; ++s, ++y)
+            {
+                rast1_update_active(hh, &active, &e, sentinel, y + 0.5f);
+                if (active)
+                    rast1_fill_active_occluded(scanline, w, active, max_weight, rule, hidden, hidden_count);
+            }
+            STATS_ADD(rows_processed, 1);
+            
+            // the boundary of the clip
+            for(int i = 0; i < span_count; ++i)
+            {
+                const uint8_t* m;
+                int x1 = spans[i].x1 < w ? spans[i].x1 : w;
+                if (spans[i].mask == CLIP_SPAN_FULL)
+                    continue;
+                m = clip->mask + spans[i].mask;
+                for(x = spans[i].x0; x < x1; ++x, ++m)
+                    scanline[x] = (uint8_t)((scanline[x] * *m + clip->full / 2) / clip->full);
+            }
+        }
+        
+        if (!sink(user, j, scanline))
+            break;
+    }
+    
+    TRACE_END(trace_clipped);
+    
+    rast1_release_active(hh, active);
+    SCANLINE_FREE(hidden);
+    return j == h;
+}
+
+void canvas_rasterize1_sorted_edges_clipped(Canvas* canvas, Edge* e, int edge_count, int vsubsample, FillRule rule, const ClipMask* clip)
+{
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    rasterize1_sorted_edges_clipped_to_sink(canvas->w, canvas->h, e, edge_count, vsubsample, rule, clip, rast1_canvas_sink, canvas);
+}
@@ -1,9 +1,45 @@
 #ifndef __CANVAS_H__
 #define __CANVAS_H__
 
-#define ARRAY_COUNT(arr) sizeof((arr)) / sizeof((arr)[0])
+#define ARRAY_COUNT(arr) (sizeof((arr)) / sizeof((arr)[0]))
 #define IFLOOR(x) ((int)floor(x))
 
+/*
+* NOTE(chan) : Every allocation goes through these, like STBIW_MALLOC of stb_image_write.h.
+* Define them before including scanline.c to use your own allocator (see bench.c).
+*/
+#ifndef SCANLINE_MALLOC
+#define SCANLINE_MALLOC(size) malloc(size)
+#define SCANLINE_REALLOC(p, size) realloc(p, size)
+#define SCANLINE_FREE(p) free(p)
+#endif
+
+/*
+* NOTE(chan) : One instance per thread, like errno.
+*/
+#ifdef _MSC_VER
+#define SCANLINE_THREAD_LOCAL __declspec(thread)
+#else
+#define SCANLINE_THREAD_LOCAL __thread
+#endif
+
+/*
+* NOTE(chan) : SSE2 is the baseline on x64, so the vectorized paths only check this.
+* Every vectorized path has a scalar fallback for the other targets.
+*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCANLINE_SSE2 1
+#endif
+
+// the pixels [x0, x1) x [y0, y1)
+typedef struct CanvasRect
+{
+    int x0, y0, x1, y1;
+} CanvasRect;
+
+// a rect that doesn't fit in the dirty list is merged into the one it grows the least
+#define CANVAS_DIRTY_MAX 16
+
 /*
 * NOTE(chan) : Top-down, left-right canvas.
 */
@@ -11,8 +47,37 @@ typedef struct Canvas
 {
     uint8_t* p;
     int w, h, comp;
+    struct MappedFile* mapped; // the file behind p, or NULL for a canvas in memory (canvas_create_mapped)
+    struct CanvasTile** tiles; // the tile directory, and p is NULL (canvas_create_tiled)
+    int tiles_x, tiles_y;
+    uint32_t generation; // the tiles of an older generation are cleared (canvas_clear)
+    CanvasRect dirty[CANVAS_DIRTY_MAX]; // the pixels changed since canvas_clear_dirty, disjoint (canvas_mark_dirty)
+    int dirty_count;
 } Canvas;
 
+#define CANVAS_TILE_SHIFT 6
+#define CANVAS_TILE (1 << CANVAS_TILE_SHIFT)
+
+// a block of the tile directory is CANVAS_DIR x CANVAS_DIR tiles, NULL until one of them is written
+#define CANVAS_DIR_SHIFT 4
+#define CANVAS_DIR (1 << CANVAS_DIR_SHIFT)
+
+typedef struct CanvasTile
+{
+    uint8_t* p; // CANVAS_TILE x CANVAS_TILE pixels, NULL until written
+    uint32_t generation; // the pixels are zero unless this is the generation of the canvas
+} CanvasTile;
+
+// uncompressed file formats of canvas_save_pnm / canvas_save_raw / canvas_create_mapped
+typedef enum CanvasFileFormat
+{
+    CANVAS_FILE_PNM = 0, // binary PGM (1 component) or PPM (3 components)
+    CANVAS_FILE_RAW = 1 // CANVAS_RAW_MAGIC, then w, h, comp as little-endian uint32, then the pixels
+} CanvasFileFormat;
+
+#define CANVAS_RAW_MAGIC "SCNL"
+#define CANVAS_RAW_HEADER_SIZE 16
+
 typedef struct CanvasColor
 {
     uint8_t r;
@@ -36,14 +101,64 @@ typedef struct Edge
     float x0, y0;
     float x1, y1;
     int invert;
+    int shape; // the paint order of the shape in a Scene, 0 otherwise
 } Edge;
 
+/*
+* NOTE(chan) : What edges_alloc_for_raster_from_polygon found about the shape.
+*/
+#define EDGE_SHAPE_CONVEX (1 << 0) // every scanline crosses at most two edges
+#define EDGE_SHAPE_RECTILINEAR (1 << 1) // every edge is vertical (the horizontal ones are skipped)
+
+typedef struct EdgeInfo
+{
+    int flags;
+    float x0, y0, x1, y1; // the bounds of the polygon in pixels (canvas_mark_dirty_info), x0 > x1 if it has no vertex
+} EdgeInfo;
+
+// which crossings of a scanline are inside (canvas_rasterize1_sorted_edges_fill_rule)
+typedef enum FillRule
+{
+    FILL_NONZERO = 0, // the winding number is not zero, the default of every rasterizer
+    FILL_EVEN_ODD = 1 // an odd number of edges on the left
+} FillRule;
+
+/*
+* NOTE(chan) : Hot path counters. Build with SCANLINE_STATS defined to collect them.
+* Otherwise the STATS_ macros are empty and the counters cost nothing.
+* They are per thread. Call raster_stats_reset before building the edges,
+* and raster_stats_get after the rasterization.
+*/
+typedef struct RasterStats
+{
+    int active_edges_max; // the longest active edge list
+    double active_edges_avg; // filled by raster_stats_get
+    int64_t active_edges_sum; // sum of the active edge counts of every subsample scanline
+    int64_t scanlines; // subsample scanlines swept
+    int64_t active_swaps; // adjacent swaps of the active list re-sort
+    int64_t heap_chunks; // chunks allocated by heap_alloc
+    int64_t pixels_touched; // pixels written by the span fill
+    int64_t rows_processed; // canvas rows that were filled
+    int64_t rows_skipped; // canvas rows without fill work (empty, or copied by a fast path)
+    int64_t edges_horizontal; // edges skipped as horizontal when building the edges
+    int64_t pixels_occluded; // pixels the span fill skipped under opaque shapes (scene.c)
+} RasterStats;
+
+#ifdef SCANLINE_STATS
+#define STATS_ADD(field, n) (g_raster_stats.field += (n))
+#define STATS_MAX(field, v) do { if ((v) > g_raster_stats.field) g_raster_stats.field = (v); } while(0)
+#else
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_MAX(field, v) ((void)0)
+#endif
+
 typedef struct ActiveEdge
 {
     struct ActiveEdge* next;
     int x, dx;
     float ey;
     int direction;
+    int shape;
 } ActiveEdge;
 
 typedef struct HeapChunk
@@ -58,4 +173,388 @@ typedef struct Heap
     int num_remaining_in_head_chunk;
 } Heap;
 
+/*
+* NOTE(chan) : Resumable sweep of canvas_rasterize1_sorted_edges (rasterize1.c).
+* The state that the sweep keeps in locals lives here, so rasterizer1_step can stop after
+* some rows and go on later, for example a slice per frame on the UI thread.
+* It owns its Heap and scanline, so it doesn't touch the per thread scratch of the other sweeps.
+*/
+typedef struct Rasterizer1
+{
+    Canvas* canvas;
+    Edge* edge_cursor; // the next edge to activate
+    Edge* sentinel;
+    ActiveEdge* active;
+    Heap heap;
+    uint8_t* scanline;
+    int j; // the next canvas row
+    int y; // the next subsample row
+    int vsubsample;
+    int max_weight;
+    FillRule rule;
+} Rasterizer1;
+
+/*
+* NOTE(chan) : The color of a shape per pixel (paint.c), evaluated over the covered runs only.
+* Make them with paint_solid, paint_linear, paint_radial and paint_image.
+*/
+typedef enum PaintType
+{
+    PAINT_SOLID = 0,
+    PAINT_LINEAR = 1,
+    PAINT_RADIAL = 2,
+    PAINT_IMAGE = 3
+} PaintType;
+
+typedef struct Paint
+{
+    PaintType type;
+    CanvasColor color; // the solid color, or the color at t = 0 of a gradient
+    CanvasColor color1; // the color at t = 1 of a gradient
+    float x0, y0; // linear : t = 0, radial : the center, image : the origin of the image
+    float x1, y1; // linear : t = 1
+    float radius; // radial : t = 1
+    float scale; // image : canvas pixels per image pixel
+    int bilinear; // image : the bilinear filter instead of the nearest
+    const Canvas* image; // image : repeated in both directions
+} Paint;
+
+/*
+* NOTE(chan) : Many colored shapes rendered in one sweep (scene.c).
+* The edges of every shape go into one list, tagged with the shape (Edge.shape),
+* which is also the paint order. scene_render sorts the list once and composites the shapes
+* of each row in that order, so the canvas is walked once whatever the shape count is.
+*/
+typedef struct SceneShape
+{
+    Paint paint;
+    FillRule rule;
+    CanvasRect rect; // the pixels the shape can cover
+    CanvasRect rendered; // the rect of the last render, repainted when the shape changes (scene_render_dirty)
+    int changed;
+} SceneShape;
+
+typedef struct Scene
+{
+    SceneShape* shapes;
+    int shape_count, shape_capacity;
+    Edge* edges; // + 1 for the sentinel
+    int edge_count, edge_capacity;
+    int vsubsample;
+    int sorted;
+    int occlusion; // skip the fill under opaque pixels of the shapes in front, on by default
+} Scene;
+
+/*
+* NOTE(chan) : Clip mask (clip.c), a clip path rasterized into per row span lists.
+* A span inside the clip has no coverage bytes at all, only the spans on the boundary of the clip
+* keep their coverage in mask. The pixels outside of every span are clipped.
+*/
+#define CLIP_SPAN_FULL ((size_t)-1)
+
+typedef struct ClipSpan
+{
+    int x0, x1; // the pixels [x0, x1)
+    size_t mask; // the offset of the coverage of the pixels in ClipMask.mask, or CLIP_SPAN_FULL
+} ClipSpan;
+
+typedef struct ClipMask
+{
+    int w, h;
+    int* rows; // h + 1 entries, the spans of the row y are spans[rows[y], rows[y + 1])
+    ClipSpan* spans;
+    int span_count, span_capacity;
+    uint8_t* mask;
+    size_t mask_size, mask_capacity;
+    int full; // the coverage inside the clip, max_weight * vsubsample of the clip path
+} ClipMask;
+
+/*
+* NOTE(chan) : Options of the speed oriented PNG encoder (png.c).
+* stbi_write_png tries the five filters on every row and runs a hash chain deflate.
+* These modes use one fixed filter and a cheap deflate instead.
+*/
+typedef enum PngFilter
+{
+    PNG_FILTER_NONE = 0,
+    PNG_FILTER_SUB = 1,
+    PNG_FILTER_UP = 2
+} PngFilter;
+
+typedef enum PngLevel
+{
+    PNG_LEVEL_STORED = 0, // no compression, stored blocks
+    PNG_LEVEL_RLE = 1, // only repeats of the previous byte, good for coverage images
+    PNG_LEVEL_FAST = 2 // greedy LZ77 with a single probe hash table
+} PngLevel;
+
+typedef struct PngOptions
+{
+    PngFilter filter;
+    PngLevel level;
+} PngOptions;
+
+/*
+* NOTE(chan) : The strips of the last canvas_save_png_cached, so the next save only encodes the strips
+* that the dirty rects of the canvas touch. Zero it before the first save.
+* The library's writers mark what they write. Code that writes canvas->p or canvas_pixel itself
+* must call canvas_mark_dirty, or the cached strips of those rows are saved again as they were.
+*/
+typedef struct PngStripCache
+{
+    int w, h, comp;
+    PngOptions options;
+    int rows_per_strip;
+    int strip_count;
+    struct PngStrip* strips;
+} PngStripCache;
+
+// growable byte buffer with a little-endian bit writer for deflate
+typedef struct PngBuffer
+{
+    uint8_t* data;
+    size_t len, capacity;
+    uint32_t bits;
+    int bit_count;
+} PngBuffer;
+
+/*
+* NOTE(chan) : OS threads. The platform headers are included before def.h (see main.c).
+*/
+typedef int (*ThreadProc)(void* arg);
+
+typedef struct Thread
+{
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    ThreadProc proc;
+    void* arg;
+} Thread;
+
+#ifdef _WIN32
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE CondVar;
+#define MUTEX_STATIC_INIT SRWLOCK_INIT
+#else
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+#define MUTEX_STATIC_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+typedef void (*ParallelForProc)(void* user, int index);
+
+/*
+* NOTE(chan) : Work stealing job pool (jobs.c).
+* Every worker has its own deque. A worker pops its newest job from the bottom,
+* and an idle worker steals the oldest job from the top of another deque.
+* worker is the index of the worker running the job, for per worker data of the caller.
+*/
+typedef void (*JobProc)(void* user, int worker);
+
+typedef struct Job
+{
+    JobProc proc;
+    void* user;
+} Job;
+
+typedef struct JobDeque
+{
+    Mutex mutex;
+    Job* jobs; // ring of capacity jobs, [top, bottom) are queued
+    int capacity;
+    int top, bottom;
+} JobDeque;
+
+typedef struct JobWorker
+{
+    struct JobPool* pool;
+    JobDeque deque;
+    Thread thread;
+    int index;
+    uint32_t random; // victim selection
+} JobWorker;
+
+typedef struct JobPool
+{
+    JobWorker* workers;
+    int worker_count;
+    volatile int queued; // jobs in the deques
+    volatile int pending; // jobs submitted and not finished
+    volatile int next_worker; // round robin target of the submissions from outside
+    int shutdown;
+    Mutex mutex;
+    CondVar wake; // queued > 0 or shutdown
+    CondVar done; // pending == 0
+} JobPool;
+
+// one polygon rendered into its own canvas by render_job_proc
+typedef struct RenderJob
+{
+    Polygon polygon;
+    float scale_x, scale_y, shift_x, shift_y;
+    int invert;
+    int vsubsample;
+    FillRule fill_rule;
+    Canvas* canvas;
+    int edge_count; // set by render_job_proc
+} RenderJob;
+
+/*
+* NOTE(chan) : Asynchronous renders (async.c).
+* render_queue_submit returns a RenderRequest at once, and the finished requests come back
+* in the order they finished from render_queue_poll or render_queue_wait.
+*/
+typedef enum RenderStatus
+{
+    RENDER_PENDING = 0,
+    RENDER_DONE = 1,
+    RENDER_CANCELLED = 2, // render_request_cancel was called, the canvas is partially written
+    RENDER_EXPIRED = 3 // the deadline passed, the canvas is partially written
+} RenderStatus;
+
+typedef struct RenderRequest
+{
+    RenderJob job;
+    double deadline; // in time_now() seconds, 0 for no deadline
+    void* user; // for the caller
+    volatile int cancelled;
+    volatile int status; // RenderStatus
+    struct RenderQueue* queue;
+    struct RenderRequest* next_done;
+} RenderRequest;
+
+typedef struct RenderQueue
+{
+    JobPool* pool;
+    Mutex mutex;
+    CondVar completed;
+    RenderRequest* done_head; // finished, not taken by render_queue_poll / render_queue_wait yet
+    RenderRequest* done_tail;
+} RenderQueue;
+
+// a file mapped into the memory, see mapped_file_create and mapped_file_open_read
+typedef struct MappedFile
+{
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+    uint8_t* data;
+    size_t size;
+} MappedFile;
+
+/*
+* NOTE(chan) : Streaming output. A rasterizer hands its finished rows to a RowSinkProc in y order,
+* and the PNG stream (png.c) takes them through a bounded ring of rows
+* that a consumer thread filters, compresses and writes while the next rows are rasterized.
+* A sink returns 0 to stop the rasterizer, for example when the render was cancelled.
+*/
+typedef int (*RowSinkProc)(void* user, int y, const uint8_t* row);
+
+/*
+* NOTE(chan) : Job file of the batch renderer (batch.c, main -batch).
+* A BatchFileHeader, the BatchJob records at job_offset, and the vertices the jobs point into.
+* All the values are little-endian, and the file is mapped and read in place,
+* so the vertices are handed to the edge builder as Vec2 without a copy.
+*/
+#define BATCH_MAGIC "SCNB"
+#define BATCH_VERSION 1
+
+typedef struct BatchFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t job_count;
+    uint32_t job_offset; // bytes from the start of the file, 8-byte aligned
+} BatchFileHeader;
+
+typedef struct BatchJob
+{
+    float scale_x, scale_y, shift_x, shift_y; // the transform of edges_alloc_for_raster_from_polygon
+    uint32_t w, h; // the canvas size
+    uint32_t vsubsample;
+    uint32_t fill_rule; // FillRule
+    uint32_t invert;
+    uint32_t vertex_count;
+    uint64_t vertex_offset; // bytes from the start of the file to vertex_count Vec2, 4-byte aligned
+    char output[64]; // a .png, .pgm or .raw file name, or empty to render without saving
+} BatchJob;
+
+typedef struct PngStream
+{
+    FILE* f;
+    int w, h, comp;
+    size_t row_bytes;
+    PngOptions options;
+    int ok;
+    
+    // ring of raw rows, rows [tail, head) are waiting for the consumer
+    uint8_t* ring;
+    int ring_rows;
+    int batch_rows;
+    int head, tail;
+    Mutex mutex;
+    CondVar not_full, not_empty;
+    Thread thread;
+    
+    // consumer state
+    uint8_t* prior; // the last raw row, for the Up filter
+    uint8_t* window; // filtered bytes, up to PNG_WINDOW of history followed by the batch
+    size_t window_len;
+    int32_t* hash;
+    uint32_t adler;
+    PngBuffer z, chunk;
+} PngStream;
+
+/*
+* NOTE(chan) : Chrome trace events. Build with SCANLINE_TRACE defined to record them,
+* and open the file of trace_dump with chrome://tracing or ui.perfetto.dev.
+* Otherwise the TRACE_ macros are empty.
+* C has no destructor, so a scope is a TraceScope variable with explicit begin and end:
+*     TRACE_DECL(trace_sort);
+*     TRACE_BEGIN(trace_sort, "sort");
+*     ...
+*     TRACE_END(trace_sort);
+* The name should be a string literal, only the pointer is kept.
+*/
+typedef struct TraceScope
+{
+    const char* name;
+    double begin;
+    int arg; // shown as args.y in the trace, -1 for none
+} TraceScope;
+
+typedef struct TraceEvent
+{
+    const char* name;
+    double begin, end;
+    int arg;
+} TraceEvent;
+
+typedef struct TraceBuffer
+{
+    struct TraceBuffer* next;
+    TraceEvent* events;
+    int count, capacity;
+    int tid;
+} TraceBuffer;
+
+#ifdef SCANLINE_TRACE
+#define TRACE_DECL(var) TraceScope var
+#define TRACE_BEGIN(var, name_literal) trace_begin(&(var), name_literal, -1)
+#define TRACE_BEGIN_ARG(var, name_literal, arg) trace_begin(&(var), name_literal, arg)
+#define TRACE_END(var) trace_end(&(var))
+#define TRACE_DUMP(file_name) trace_dump(file_name)
+#else
+#define TRACE_DECL(var)
+#define TRACE_BEGIN(var, name_literal) ((void)0)
+#define TRACE_BEGIN_ARG(var, name_literal, arg) ((void)0)
+#define TRACE_END(var) ((void)0)
+#define TRACE_DUMP(file_name) ((void)0)
+#endif
+
 #endif
\ No newline at end of file
@@ -1,9 +1,9 @@
 #include "def.h"
 
-Edge* edges_alloc_for_raster_from_polygon(Polygon* p, float scale_x, float scale_y, float shift_x, float shift_y, int invert, int vsubsample, int* out_edge_count)
+static Edge* edges_alloc_from_polygon(Polygon* p, float scale_x, float scale_y, float shift_x, float shift_y, int invert, int vsubsample, int keep_horizontal, int* out_edge_count, EdgeInfo* out_info)
 {
     float y_scale_inv = invert ? -scale_y : scale_y;
-    Edge* edges = (Edge*)malloc(sizeof(Edge) * (p->count + 1)); // add an extra one as a sentinel
+    Edge* edges = (Edge*)SCANLINE_MALLOC(sizeof(Edge) * (p->count + 1)); // add an extra one as a sentinel
     
     /*
 * NOTE(chan)
@@ -25,15 +25,88 @@ Edge* edges_alloc_for_raster_from_polygon(Polygon* p, float scale_x, float scale
 */
     int edge_n = 0;
     int j = p->count - 1;
+    
+    /*
+* NOTE(chan) : Shape classification for the fast paths, done in the same pass.
+* A polygon is convex if all of its turns have the same sign,
+* and its y direction changes only twice around the loop (so it doesn't wind more than once).
+* Then every scanline crosses at most two edges.
+* Zero-length edges and collinear turns are ignored.
+* A polygon is rectilinear if none of its edges is diagonal.
+*/
+    float first_dx = 0.f, first_dy = 0.f, prev_dx = 0.f, prev_dy = 0.f;
+    int has_prev = 0, turn_pos = 0, turn_neg = 0;
+    int first_dy_sign = 0, prev_dy_sign = 0, dy_changes = 0;
+    int diagonal_count = 0;
+    float bx0 = 1.f, by0 = 1.f, bx1 = 0.f, by1 = 0.f; // the bounds, empty until the first vertex
+    TRACE_DECL(trace_build);
+    
+    TRACE_BEGIN(trace_build, "edge build");
+    
     for(int k = 0; k < p->count;j=k++)
     {
         int a = k, b = j; // a : start point, b : end point
         
+        if (out_info)
+        {
+            float dx = p->vertices[k].x - p->vertices[j].x;
+            float dy = p->vertices[k].y - p->vertices[j].y;
+            float vx = p->vertices[k].x * scale_x + shift_x;
+            float vy = p->vertices[k].y * y_scale_inv + shift_y;
+            
+            if (k == 0)
+            {
+                bx0 = bx1 = vx;
+                by0 = by1 = vy;
+            }
+            else
+            {
+                if (vx < bx0) bx0 = vx;
+                if (vx > bx1) bx1 = vx;
+                if (vy < by0) by0 = vy;
+                if (vy > by1) by1 = vy;
+            }
+            
+            diagonal_count += (dx != 0.f && dy != 0.f);
+            if (dx != 0.f || dy != 0.f)
+            {
+                if (has_prev)
+                {
+                    float cross = prev_dx * dy - prev_dy * dx;
+                    turn_pos += (cross > 0.f);
+                    turn_neg += (cross < 0.f);
+                }
+                else
+                {
+                    first_dx = dx;
+                    first_dy = dy;
+                    has_prev = 1;
+                }
+                prev_dx = dx;
+                prev_dy = dy;
+            }
+            
+            if (dy != 0.f)
+            {
+                int dy_sign = dy > 0.f ? 1 : -1;
+                if (prev_dy_sign == 0)
+                    first_dy_sign = dy_sign;
+                else if (prev_dy_sign != dy_sign)
+                    ++dy_changes;
+                prev_dy_sign = dy_sign;
+            }
+        }
+        
         // NOTE(sean) : skip the edge if horizontal
-        if (p->vertices[a].y == p->vertices[b].y)
+        // NOTE(chan) : the scanline never crosses a horizontal edge, but the distance field needs it.
+        if (p->vertices[a].y == p->vertices[b].y && !keep_horizontal)
+        {
+            STATS_ADD(edges_horizontal, 1);
             continue;
+        }
         
         edges[edge_n].invert = 0;
+        edges[edge_n].shape = 0;
         if(invert ? p->vertices[b].y > p->vertices[a].y : p->vertices[b].y < p->vertices[a].y)
         {
             edges[edge_n].invert = 1;
@@ -49,12 +122,52 @@ Edge* edges_alloc_for_raster_from_polygon(Polygon* p, float scale_x, float scale
     
     *out_edge_count = edge_n;
     
+    if (out_info)
+    {
+        // close the loop : the turn and the y direction change from the last edge to the first edge
+        float cross = prev_dx * first_dy - prev_dy * first_dx;
+        turn_pos += (cross > 0.f);
+        turn_neg += (cross < 0.f);
+        if (prev_dy_sign != first_dy_sign)
+            ++dy_changes;
+        
+        out_info->flags = 0;
+        if (!(turn_pos && turn_neg) && dy_changes <= 2)
+            out_info->flags |= EDGE_SHAPE_CONVEX;
+        if (diagonal_count == 0)
+            out_info->flags |= EDGE_SHAPE_RECTILINEAR;
+        out_info->x0 = bx0;
+        out_info->y0 = by0;
+        out_info->x1 = bx1;
+        out_info->y1 = by1;
+    }
+    
+    TRACE_END(trace_build);
     return edges;
 }
 
+/*
+* NOTE(chan) : out_info can be NULL.
+* Otherwise it tells which fast path can rasterize the edges,
+* see canvas_rasterize1_sorted_edges_with_info.
+*/
+Edge* edges_alloc_for_raster_from_polygon(Polygon* p, float scale_x, float scale_y, float shift_x, float shift_y, int invert, int vsubsample, int* out_edge_count, EdgeInfo* out_info)
+{
+    return edges_alloc_from_polygon(p, scale_x, scale_y, shift_x, shift_y, invert, vsubsample, 0, out_edge_count, out_info);
+}
+
+/*
+* NOTE(chan) : Same as edges_alloc_for_raster_from_polygon without vertical subsampling,
+* but it keeps the horizontal edges. Use this for canvas_sdf_edges.
+*/
+Edge* edges_alloc_for_sdf_from_polygon(Polygon* p, float scale_x, float scale_y, float shift_x, float shift_y, int invert, int* out_edge_count)
+{
+    return edges_alloc_from_polygon(p, scale_x, scale_y, shift_x, shift_y, invert, 1, 1, out_edge_count, NULL);
+}
+
 void edges_free(Edge* edges)
 {
-    free(edges);
+    SCANLINE_FREE(edges);
 }
 
 /*
@@ -174,6 +287,9 @@ static void edges_sort_quick(Edge* edges, int count)
 
 void edges_sort(Edge* edges, int count)
 {
+    TRACE_DECL(trace_sort);
+    TRACE_BEGIN(trace_sort, "sort");
     edges_sort_quick(edges, count);
     edges_sort_insertion(edges, count);
+    TRACE_END(trace_sort);
 }
\ No newline at end of file
@@ -17,9 +17,10 @@ static void* heap_alloc(Heap* h, size_t size)
         if (h->num_remaining_in_head_chunk == 0)
         {
             int count = (size < 32 ? 2000 : size < 128 ? 800 : 100);
-            HeapChunk* c = (HeapChunk*)malloc(sizeof(HeapChunk) + size * count);
+            HeapChunk* c = (HeapChunk*)SCANLINE_MALLOC(sizeof(HeapChunk) + size * count);
             if(c == NULL)
                 return NULL;
+            STATS_ADD(heap_chunks, 1);
             
             c->next = h->head;
             h->head = c;
@@ -50,7 +51,7 @@ static void heap_cleanup(Heap* h)
     while(c)
     {
         HeapChunk* n = c->next;
-        free(c);
+        SCANLINE_FREE(c);
         c = n;
     }
 }
\ No newline at end of file
@@ -0,0 +1,278 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Work stealing job pool.
+* The render jobs are independent, but their sizes go from a triangle to a 100k edge coastline.
+* Splitting them evenly over the threads up front leaves the threads with the small jobs idle,
+* so every worker takes jobs from its own deque, and steals from the others when it runs dry.
+* - A worker pops from the bottom of its deque (the newest job, still warm in the cache).
+* - A thief steals from the top (the oldest job), so it meets the owner only on the last job.
+* - A job submitted from a worker goes to the deque of that worker,
+*   a job submitted from outside goes to the workers in turn.
+* Each deque has its own lock. The owner and a thief only contend when they touch the same deque.
+* The sweep keeps its Heap and scanline per thread (Rast1Scratch), so a worker reuses them for every job
+* and releases them when it exits.
+*/
+
+static SCANLINE_THREAD_LOCAL JobWorker* g_job_worker; // the worker running on this thread, if any
+
+static void job_deque_init(JobDeque* d)
+{
+    mutex_init(&d->mutex);
+    d->capacity = 64;
+    d->jobs = (Job*)SCANLINE_MALLOC(sizeof(Job) * d->capacity);
+    d->top = 0;
+    d->bottom = 0;
+}
+
+static void job_deque_destroy(JobDeque* d)
+{
+    SCANLINE_FREE(d->jobs);
+    mutex_destroy(&d->mutex);
+}
+
+static void job_deque_push(JobDeque* d, Job job)
+{
+    mutex_lock(&d->mutex);
+    if (d->bottom - d->top == d->capacity)
+    {
+        // grow the ring and unwrap it
+        Job* jobs = (Job*)SCANLINE_MALLOC(sizeof(Job) * d->capacity * 2);
+        for(int i = d->top; i < d->bottom; ++i)
+            jobs[i - d->top] = d->jobs[i % d->capacity];
+        SCANLINE_FREE(d->jobs);
+        d->jobs = jobs;
+        d->bottom -= d->top;
+        d->top = 0;
+        d->capacity *= 2;
+    }
+    d->jobs[d->bottom % d->capacity] = job;
+    ++d->bottom;
+    mutex_unlock(&d->mutex);
+}
+
+// the owner end, returns 0 if the deque is empty
+static int job_deque_pop(JobDeque* d, Job* job)
+{
+    int found = 0;
+    mutex_lock(&d->mutex);
+    if (d->bottom > d->top)
+    {
+        --d->bottom;
+        *job = d->jobs[d->bottom % d->capacity];
+        found = 1;
+    }
+    if (d->bottom == d->top)
+        d->top = d->bottom = 0; // keep the indices small
+    mutex_unlock(&d->mutex);
+    return found;
+}
+
+// the thief end, returns 0 if the deque is empty
+static int job_deque_steal(JobDeque* d, Job* job)
+{
+    int found = 0;
+    mutex_lock(&d->mutex);
+    if (d->bottom > d->top)
+    {
+        *job = d->jobs[d->top % d->capacity];
+        ++d->top;
+        found = 1;
+    }
+    mutex_unlock(&d->mutex);
+    return found;
+}
+
+static int job_pool_find(JobWorker* w, Job* job)
+{
+    JobPool* pool = w->pool;
+    int start;
+    
+    if (job_deque_pop(&w->deque, job))
+        return 1;
+    
+    // xorshift, to spread the thieves over the victims
+    w->random ^= w->random << 13;
+    w->random ^= w->random >> 17;
+    w->random ^= w->random << 5;
+    start = (int)(w->random % (uint32_t)pool->worker_count);
+    
+    for(int i = 0; i < pool->worker_count; ++i)
+    {
+        JobWorker* victim = pool->workers + (start + i) % pool->worker_count;
+        if (victim != w && job_deque_steal(&victim->deque, job))
+            return 1;
+    }
+    return 0;
+}
+
+static int job_pool_worker(void* arg)
+{
+    JobWorker* w = (JobWorker*)arg;
+    JobPool* pool = w->pool;
+    Job job;
+    
+    g_job_worker = w;
+    
+    for(;;)
+    {
+        if (job_pool_find(w, &job))
+        {
+            atomic_fetch_add_int(&pool->queued, -1);
+            job.proc(job.user, w->index);
+            
+            if (atomic_fetch_add_int(&pool->pending, -1) == 1)
+            {
+                mutex_lock(&pool->mutex);
+                cond_broadcast(&pool->done);
+                mutex_unlock(&pool->mutex);
+            }
+            continue;
+        }
+        
+        // nothing to pop or steal, sleep until a submission
+        mutex_lock(&pool->mutex);
+        while(atomic_fetch_add_int(&pool->queued, 0) <= 0 && !pool->shutdown)
+            cond_wait(&pool->wake, &pool->mutex);
+        if (pool->shutdown && atomic_fetch_add_int(&pool->queued, 0) <= 0)
+        {
+            mutex_unlock(&pool->mutex);
+            break;
+        }
+        mutex_unlock(&pool->mutex);
+    }
+    
+    g_job_worker = NULL;
+    return 0;
+}
+
+// thread_count <= 0 for all the hardware threads. Returns NULL if a worker thread can't be started.
+JobPool* job_pool_create(int thread_count)
+{
+    JobPool* pool = (JobPool*)SCANLINE_MALLOC(sizeof(JobPool));
+    int spawned = 0;
+    
+    if (thread_count <= 0)
+        thread_count = thread_hardware_count();
+    
+    memset(pool, 0, sizeof(*pool));
+    pool->worker_count = thread_count;
+    pool->workers = (JobWorker*)SCANLINE_MALLOC(sizeof(JobWorker) * thread_count);
+    mutex_init(&pool->mutex);
+    cond_init(&pool->wake);
+    cond_init(&pool->done);
+    
+    for(int i = 0; i < thread_count; ++i)
+    {
+        JobWorker* w = pool->workers + i;
+        w->pool = pool;
+        w->index = i;
+        w->random = 0x9E3779B9u * (uint32_t)(i + 1);
+        job_deque_init(&w->deque);
+    }
+    for(; spawned < thread_count; ++spawned)
+    {
+        if (!thread_create(&pool->workers[spawned].thread, job_pool_worker, pool->workers + spawned))
+            break;
+    }
+    
+    if (spawned < thread_count)
+    {
+        // the workers steal from every deque, so a pool with a missing worker can't run. Stop the started ones.
+        mutex_lock(&pool->mutex);
+        pool->shutdown = 1;
+        cond_broadcast(&pool->wake);
+        mutex_unlock(&pool->mutex);
+        
+        for(int i = 0; i < spawned; ++i)
+            thread_join(&pool->workers[i].thread);
+        for(int i = 0; i < thread_count; ++i)
+            job_deque_destroy(&pool->workers[i].deque);
+        
+        cond_destroy(&pool->done);
+        cond_destroy(&pool->wake);
+        mutex_destroy(&pool->mutex);
+        SCANLINE_FREE(pool->workers);
+        SCANLINE_FREE(pool);
+        return NULL;
+    }
+    
+    return pool;
+}
+
+/*
+* Queue proc(user, worker) on the pool. It can be called from a job too,
+* then the new job goes to the deque of the worker running that job.
+*/
+void job_pool_submit(JobPool* pool, JobProc proc, void* user)
+{
+    Job job;
+    JobWorker* w = g_job_worker;
+    
+    job.proc = proc;
+    job.user = user;
+    
+    if (w == NULL || w->pool != pool)
+        w = pool->workers + (unsigned)atomic_fetch_add_int(&pool->next_worker, 1) % (unsigned)pool->worker_count;
+    
+    atomic_fetch_add_int(&pool->pending, 1);
+    job_deque_push(&w->deque, job);
+    atomic_fetch_add_int(&pool->queued, 1);
+    
+    // a worker checks queued under the mutex before it sleeps, so the signal can't be lost
+    mutex_lock(&pool->mutex);
+    cond_signal(&pool->wake);
+    mutex_unlock(&pool->mutex);
+}
+
+// wait until every submitted job has finished. Don't call it from a job.
+void job_pool_wait(JobPool* pool)
+{
+    mutex_lock(&pool->mutex);
+    while(atomic_fetch_add_int(&pool->pending, 0) > 0)
+        cond_wait(&pool->done, &pool->mutex);
+    mutex_unlock(&pool->mutex);
+}
+
+// finishes the queued jobs, then joins the workers
+void job_pool_destroy(JobPool* pool)
+{
+    mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    cond_broadcast(&pool->wake);
+    mutex_unlock(&pool->mutex);
+    
+    for(int i = 0; i < pool->worker_count; ++i)
+        thread_join(&pool->workers[i].thread);
+    for(int i = 0; i < pool->worker_count; ++i)
+        job_deque_destroy(&pool->workers[i].deque);
+    
+    cond_destroy(&pool->done);
+    cond_destroy(&pool->wake);
+    mutex_destroy(&pool->mutex);
+    SCANLINE_FREE(pool->workers);
+    SCANLINE_FREE(pool);
+}
+
+/*
+* NOTE(chan) : A whole render as one job, polygon -> edges -> sort -> rasterize into job->canvas.
+*     job_pool_submit(pool, render_job_proc, &render_job);
+*/
+void render_job_proc(void* user, int worker)
+{
+    RenderJob* job = (RenderJob*)user;
+    EdgeInfo info;
+    Edge* edges;
+    TRACE_DECL(trace_job);
+    
+    (void)worker;
+    TRACE_BEGIN(trace_job, "render job");
+    
+    edges = edges_alloc_for_raster_from_polygon(&job->polygon, job->scale_x, job->scale_y, job->shift_x, job->shift_y,
+                                                job->invert, job->vsubsample, &job->edge_count, &info);
+    edges_sort(edges, job->edge_count);
+    canvas_rasterize1_sorted_edges_with_info_fill_rule(job->canvas, edges, job->edge_count, job->vsubsample, &info, job->fill_rule);
+    edges_free(edges);
+    
+    TRACE_END(trace_job);
+}
@@ -0,0 +1,140 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Subpixel (LCD) rendering.
+* An LCD pixel is made of three horizontal stripes (R, G, B).
+* So we rasterize the edges at 3x horizontal resolution and each
+* subpixel sample becomes the coverage of one color channel.
+* 
+* Sampling each stripe alone gives strong color fringes, so the samples go through
+* a 5-tap FIR filter before they are written. These are the default LCD filter weights of FreeType.
+* They sum to 256, so the filtered value is never bigger than 255 and we can shift instead of divide.
+* 
+* The subpixel order of the 3x scanline is already the interleaved RGB order of the canvas row
+* (subpixel 3 * x + c is the channel c of the pixel x).
+* Therefore the filter stores its result straight into the canvas row and the packing is free.
+* We only keep one 3x scanline, not a 3x canvas.
+*/
+#define LCD_FILTER_TAPS 5
+#define LCD_PAD 16 // zero bytes on both sides of the 3x scanline for the filter taps and the vector loads
+
+static const uint8_t LCD_FILTER_WEIGHTS[LCD_FILTER_TAPS] = {8, 77, 86, 77, 8};
+
+/*
+* dst[k] = sum(w[t] * src[k + t - 2]) >> 8 for k in [0, len)
+* src must be readable from src[-2] to src[len + 2].
+*/
+static void lcd_filter_row(uint8_t* dst, const uint8_t* src, int len)
+{
+    int k = 0;
+    
+#ifdef SCANLINE_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i w0 = _mm_set1_epi16(LCD_FILTER_WEIGHTS[0]);
+    __m128i w1 = _mm_set1_epi16(LCD_FILTER_WEIGHTS[1]);
+    __m128i w2 = _mm_set1_epi16(LCD_FILTER_WEIGHTS[2]);
+    
+    // NOTE(chan) : The weights are symmetric, so add the mirrored taps before multiplying.
+    // The sum of 255 * 256 still fits in an unsigned 16-bit lane.
+    for(; k + 16 <= len; k += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + k - 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + k - 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + k));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + k + 1));
+        __m128i e = _mm_loadu_si128((const __m128i*)(src + k + 2));
+        
+        __m128i ae_lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(e, zero));
+        __m128i ae_hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(e, zero));
+        __m128i bd_lo = _mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(d, zero));
+        __m128i bd_hi = _mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(d, zero));
+        
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(ae_lo, w0), _mm_mullo_epi16(bd_lo, w1));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(ae_hi, w0), _mm_mullo_epi16(bd_hi, w1));
+        lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), w2));
+        hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), w2));
+        
+        lo = _mm_srli_epi16(lo, 8);
+        hi = _mm_srli_epi16(hi, 8);
+        _mm_storeu_si128((__m128i*)(dst + k), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    
+    for(; k < len; ++k)
+    {
+        int sum = 
+            LCD_FILTER_WEIGHTS[0] * (src[k - 2] + src[k + 2]) +
+            LCD_FILTER_WEIGHTS[1] * (src[k - 1] + src[k + 1]) +
+            LCD_FILTER_WEIGHTS[2] * src[k];
+        dst[k] = (uint8_t)(sum >> 8);
+    }
+}
+
+/*
+* NOTE(chan) : The canvas should have 3 components, and the edges should be built
+* with 3x horizontal scale and shift, like this:
+* edges_alloc_for_raster_from_polygon(p, scale_x * 3, scale_y, shift_x * 3, shift_y, invert, vsubsample, &count);
+* Each canvas row is written with the filtered RGB coverage.
+*/
+void canvas_rasterize1_sorted_edges_lcd(Canvas* canvas, Edge* e, int edge_count, int vsubsample)
+{
+    Heap hh = {0, 0, 0};
+    size_t stride = (size_t)canvas->w * canvas->comp;
+    int sub_w = canvas->w * 3;
+    int j = 0;
+    int y = 0;
+    int max_weight = (255 / vsubsample);
+    int s;
+    ActiveEdge* active = NULL;
+    Edge* sentinel = e + edge_count;
+    uint8_t* buffer = (uint8_t*)SCANLINE_MALLOC(sub_w + LCD_PAD * 2);
+    uint8_t* scanline = buffer + LCD_PAD;
+    uint8_t* out = canvas->tiles ? (uint8_t*)SCANLINE_MALLOC(stride) : NULL; // a tiled canvas takes the rows with canvas_write_row
+    TRACE_DECL(trace_band);
+    
+    assert(canvas->comp == 3);
+    if (buffer == NULL || (canvas->tiles && out == NULL))
+    {
+        SCANLINE_FREE(buffer);
+        SCANLINE_FREE(out);
+        return;
+    }
+    memset(buffer, 0, sub_w + LCD_PAD * 2);
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    
+    while(j < canvas->h)
+    {
+        if (j % RAST1_TRACE_BAND == 0)
+            TRACE_BEGIN_ARG(trace_band, "rasterize band lcd", j);
+        
+        memset(scanline, 0, sub_w);
+        for(s = 0; s < vsubsample; ++s)
+        {
+            float scan_y = y + 0.5f;
+            
+            rast1_update_active(&hh, &active, &e, sentinel, scan_y);
+            
+            if (active)
+                rast1_fill_active(scanline, sub_w, active, max_weight, FILL_NONZERO);
+            
+            ++y;
+        }
+        
+        if (out)
+        {
+            lcd_filter_row(out, scanline, sub_w);
+            canvas_write_row(canvas, j, out, stride);
+        }
+        else
+            lcd_filter_row(canvas->p + (size_t)j * stride, scanline, sub_w);
+        ++j;
+        
+        if (j % RAST1_TRACE_BAND == 0 || j == canvas->h)
+            TRACE_END(trace_band);
+    }
+    
+    heap_cleanup(&hh);
+    
+    SCANLINE_FREE(out);
+    SCANLINE_FREE(buffer);
+}
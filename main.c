@@ -21,24 +21,38 @@
 *     - 5) Advance every active edge to the next scanline by computing their next x intersection (which just requires adding a constant dx/dy associated with the edge)
 */
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include "scanline.c"
 
-#include <stdio.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <stdbool.h>
-#include <math.h>
-#include <assert.h>
-
-#include "heap.c"
-#include "canvas.c"
-#include "edge.c"
-#include "rasterize1.c"
-
-int main()
+/*
+* NOTE(chan) : Without arguments, this renders the star below into scanline.png.
+* main -batch jobs.bin [-threads n] renders the jobs of a batch file instead (see batch.c).
+*/
+int main(int argc, char** argv)
 {
     const char* file_name = "scanline.png";
+    const char* batch_file = NULL;
+    int thread_count = 0;
+    
+    for(int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-batch") && i + 1 < argc)
+            batch_file = argv[++i];
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+            thread_count = atoi(argv[++i]);
+        else
+        {
+            printf("usage : %s [-batch jobs.bin [-threads n]]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    if (batch_file)
+    {
+        int failed = batch_run(batch_file, thread_count);
+        TRACE_DUMP("scanline_trace.json");
+        return failed == 0 ? 0 : 1;
+    }
+    
     Canvas* canvas = canvas_create(256, 256);
     
     int x_diff = 28;
@@ -76,7 +90,8 @@ int main()
     
     // Algorithm 1
     int edge_count = 0;
-    Edge* edges = edges_alloc_for_raster_from_polygon(&polygon, scale_x, scale_y, shift_x, shift_y, invert, vsubsample, &edge_count);
+    EdgeInfo edge_info;
+    Edge* edges = edges_alloc_for_raster_from_polygon(&polygon, scale_x, scale_y, shift_x, shift_y, invert, vsubsample, &edge_count, &edge_info);
     
     for(int i = 0; i < edge_count; ++i)
     {
@@ -92,12 +107,14 @@ int main()
     // canvas_fill_edges(canvas, edges, edge_count, CANVAS_C_BLUE); // to see the edges are correct
     
     // Algorithm 3
-    canvas_rasterize1_sorted_edges(canvas, edges, edge_count, vsubsample);
+    canvas_rasterize1_sorted_edges_with_info(canvas, edges, edge_count, vsubsample, &edge_info);
     
     edges_free(edges);
     
     canvas_save(canvas, "scanline.png");
     canvas_destroy(canvas);
     
+    TRACE_DUMP("scanline_trace.json");
+    
     return 0;
 }
\ No newline at end of file
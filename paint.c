@@ -0,0 +1,375 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Paints, the color of a shape per pixel instead of one color.
+* A gradient used to be hundreds of thin polygons, each one a full sweep.
+* Now the shape is rasterized once, and the paint is evaluated only over the covered runs of a row
+* and blended by the coverage (paint_blend_span).
+* - linear : t is the projection on (x0, y0) -> (x1, y1), clamped to [0, 1].
+* - radial : t is the distance to (x0, y0) over radius, clamped to [0, 1].
+* - image : the image repeated over the plane, its origin at (x0, y0), scale canvas pixels per image pixel,
+*   with the nearest or the bilinear filter.
+* The gradients blend color and color1 by t. Along a row t changes by a constant (linear) or
+* the distance is a function of a constant step (radial), so the SSE2 loop steps 4 pixels at once
+* from the first pixel of the run, and the scalar loop does the tail.
+* The image paint is scalar by design : its cost is the texel fetch, a gather at wrapped addresses
+* (an integer modulo per pixel), and SSE2 has neither, so stepping u 4 pixels at once would only save an add.
+* The pixel centers are at + 0.5, like the scanlines.
+*/
+
+Paint paint_solid(CanvasColor color)
+{
+    Paint p;
+    memset(&p, 0, sizeof(p));
+    p.type = PAINT_SOLID;
+    p.color = color;
+    return p;
+}
+
+Paint paint_linear(float x0, float y0, CanvasColor color0, float x1, float y1, CanvasColor color1)
+{
+    Paint p = paint_solid(color0);
+    p.type = PAINT_LINEAR;
+    p.color1 = color1;
+    p.x0 = x0;
+    p.y0 = y0;
+    p.x1 = x1;
+    p.y1 = y1;
+    return p;
+}
+
+Paint paint_radial(float cx, float cy, float radius, CanvasColor color0, CanvasColor color1)
+{
+    Paint p = paint_solid(color0);
+    p.type = PAINT_RADIAL;
+    p.color1 = color1;
+    p.x0 = cx;
+    p.y0 = cy;
+    p.radius = radius;
+    return p;
+}
+
+// the image must be linear (not canvas_create_tiled), have 1 or 3 (or more, the first 3 are used) components, and live as long as the paint
+Paint paint_image(const Canvas* image, float x, float y, float scale, int bilinear)
+{
+    Paint p;
+    assert(image->tiles == NULL);
+    memset(&p, 0, sizeof(p));
+    p.type = PAINT_IMAGE;
+    p.image = image;
+    p.x0 = x;
+    p.y0 = y;
+    p.scale = scale > 0.f ? scale : 1.f;
+    p.bilinear = bilinear;
+    return p;
+}
+
+static void paint_ramp(const Paint* p, float t, uint8_t* rgb)
+{
+    if (t < 0.f) t = 0.f;
+    if (t > 1.f) t = 1.f;
+    rgb[0] = (uint8_t)(p->color.r + (p->color1.r - p->color.r) * t + 0.5f);
+    rgb[1] = (uint8_t)(p->color.g + (p->color1.g - p->color.g) * t + 0.5f);
+    rgb[2] = (uint8_t)(p->color.b + (p->color1.b - p->color.b) * t + 0.5f);
+}
+
+#ifdef SCANLINE_SSE2
+// paint_ramp of 4 pixels
+static void paint_ramp4(const Paint* p, __m128 t, uint8_t* rgb)
+{
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128i r, g, b;
+    int32_t lanes[12];
+    
+    t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.f));
+    r = _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(_mm_set1_ps(p->color.r), _mm_mul_ps(_mm_set1_ps((float)(p->color1.r - p->color.r)), t)), half));
+    g = _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(_mm_set1_ps(p->color.g), _mm_mul_ps(_mm_set1_ps((float)(p->color1.g - p->color.g)), t)), half));
+    b = _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(_mm_set1_ps(p->color.b), _mm_mul_ps(_mm_set1_ps((float)(p->color1.b - p->color.b)), t)), half));
+    _mm_storeu_si128((__m128i*)lanes, r);
+    _mm_storeu_si128((__m128i*)(lanes + 4), g);
+    _mm_storeu_si128((__m128i*)(lanes + 8), b);
+    
+    for(int i = 0; i < 4; ++i)
+    {
+        rgb[3 * i + 0] = (uint8_t)lanes[i];
+        rgb[3 * i + 1] = (uint8_t)lanes[4 + i];
+        rgb[3 * i + 2] = (uint8_t)lanes[8 + i];
+    }
+}
+#endif
+
+static void paint_span_linear(const Paint* p, int x, int y, int count, uint8_t* rgb)
+{
+    float dx = p->x1 - p->x0, dy = p->y1 - p->y0;
+    float len2 = dx * dx + dy * dy;
+    float gx = len2 > 0.f ? dx / len2 : 0.f;
+    float gy = len2 > 0.f ? dy / len2 : 0.f;
+    float t = (x + 0.5f - p->x0) * gx + (y + 0.5f - p->y0) * gy;
+    int i = 0;
+    
+#ifdef SCANLINE_SSE2
+    {
+        __m128 tv = _mm_add_ps(_mm_set1_ps(t), _mm_mul_ps(_mm_set_ps(3.f, 2.f, 1.f, 0.f), _mm_set1_ps(gx)));
+        __m128 step = _mm_set1_ps(4.f * gx);
+        for(; i + 4 <= count; i += 4)
+        {
+            paint_ramp4(p, tv, rgb + 3 * i);
+            tv = _mm_add_ps(tv, step);
+        }
+        t += i * gx;
+    }
+#endif
+    
+    for(; i < count; ++i)
+    {
+        paint_ramp(p, t, rgb + 3 * i);
+        t += gx;
+    }
+}
+
+static void paint_span_radial(const Paint* p, int x, int y, int count, uint8_t* rgb)
+{
+    float inv_radius = p->radius > 0.f ? 1.f / p->radius : 0.f;
+    float dx = x + 0.5f - p->x0;
+    float dy = y + 0.5f - p->y0;
+    int i = 0;
+    
+#ifdef SCANLINE_SSE2
+    {
+        __m128 dxv = _mm_add_ps(_mm_set1_ps(dx), _mm_set_ps(3.f, 2.f, 1.f, 0.f));
+        __m128 dy2 = _mm_set1_ps(dy * dy);
+        __m128 inv = _mm_set1_ps(inv_radius);
+        __m128 step = _mm_set1_ps(4.f);
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dxv, dxv), dy2));
+            paint_ramp4(p, _mm_mul_ps(d, inv), rgb + 3 * i);
+            dxv = _mm_add_ps(dxv, step);
+        }
+        dx += (float)i;
+    }
+#endif
+    
+    for(; i < count; ++i)
+    {
+        paint_ramp(p, sqrtf(dx * dx + dy * dy) * inv_radius, rgb + 3 * i);
+        dx += 1.f;
+    }
+}
+
+static int paint_wrap(int i, int n)
+{
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+static void paint_texel(const Canvas* image, int u, int v, int* rgb)
+{
+    const uint8_t* t = image->p + ((size_t)v * image->w + u) * image->comp;
+    rgb[0] = t[0];
+    rgb[1] = image->comp >= 3 ? t[1] : t[0];
+    rgb[2] = image->comp >= 3 ? t[2] : t[0];
+}
+
+/*
+* The image coordinates step by 1 / scale along the row, in 16.16 fixed point,
+* and the bilinear weights are the top 8 bits of the fraction.
+*/
+static void paint_span_image(const Paint* p, int x, int y, int count, uint8_t* rgb)
+{
+    const Canvas* image = p->image;
+    float inv_scale = 1.f / p->scale;
+    float u = (x + 0.5f - p->x0) * inv_scale;
+    float v = (y + 0.5f - p->y0) * inv_scale;
+    
+    if (!p->bilinear)
+    {
+        int64_t fu = (int64_t)floor(u * 65536.0);
+        int64_t du = (int64_t)floor(inv_scale * 65536.0);
+        int row = paint_wrap(IFLOOR(v), image->h);
+        for(int i = 0; i < count; ++i, fu += du)
+        {
+            int c[3];
+            paint_texel(image, paint_wrap((int)(fu >> 16), image->w), row, c);
+            rgb[3 * i + 0] = (uint8_t)c[0];
+            rgb[3 * i + 1] = (uint8_t)c[1];
+            rgb[3 * i + 2] = (uint8_t)c[2];
+        }
+    }
+    else
+    {
+        // the texel centers are at + 0.5 too
+        int64_t fu = (int64_t)floor((u - 0.5f) * 65536.0);
+        int64_t du = (int64_t)floor(inv_scale * 65536.0);
+        float vf = v - 0.5f;
+        int v0 = IFLOOR(vf);
+        int wy = (int)((vf - v0) * 256.f);
+        int r0 = paint_wrap(v0, image->h);
+        int r1 = paint_wrap(v0 + 1, image->h);
+        for(int i = 0; i < count; ++i, fu += du)
+        {
+            int u0 = (int)(fu >> 16);
+            int wx = (int)((fu >> 8) & 255);
+            int a[3], b[3], c[3], d[3];
+            int c0 = paint_wrap(u0, image->w), c1 = paint_wrap(u0 + 1, image->w);
+            paint_texel(image, c0, r0, a);
+            paint_texel(image, c1, r0, b);
+            paint_texel(image, c0, r1, c);
+            paint_texel(image, c1, r1, d);
+            for(int k = 0; k < 3; ++k)
+            {
+                int top = a[k] * (256 - wx) + b[k] * wx;
+                int bottom = c[k] * (256 - wx) + d[k] * wx;
+                rgb[3 * i + k] = (uint8_t)((top * (256 - wy) + bottom * wy + 32768) >> 16);
+            }
+        }
+    }
+}
+
+// the colors of the pixels [x, x + count) of the row y, 3 bytes per pixel
+void paint_span(const Paint* p, int x, int y, int count, uint8_t* rgb)
+{
+    switch(p->type)
+    {
+        case PAINT_LINEAR:
+        {
+            paint_span_linear(p, x, y, count, rgb);
+        } break;
+        case PAINT_RADIAL:
+        {
+            paint_span_radial(p, x, y, count, rgb);
+        } break;
+        case PAINT_IMAGE:
+        {
+            paint_span_image(p, x, y, count, rgb);
+        } break;
+        default:
+        {
+            for(int i = 0; i < count; ++i)
+            {
+                rgb[3 * i + 0] = p->color.r;
+                rgb[3 * i + 1] = p->color.g;
+                rgb[3 * i + 2] = p->color.b;
+            }
+        } break;
+    }
+}
+
+// source over of count pixels of rgb by their coverage, on a 1 (gray) or 3+ component row
+static void paint_blend_span(uint8_t* dst, int comp, const uint8_t* cover, const uint8_t* rgb, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        int a = cover[i];
+        const uint8_t* c = rgb + 3 * i;
+        if (a == 0)
+            continue;
+        if (comp == 1)
+        {
+            int gray = (c[0] * 77 + c[1] * 150 + c[2] * 29) >> 8;
+            dst[i] = (uint8_t)((dst[i] * (255 - a) + gray * a + 127) / 255);
+        }
+        else
+        {
+            uint8_t* q = dst + (size_t)i * comp;
+            q[0] = (uint8_t)((q[0] * (255 - a) + c[0] * a + 127) / 255);
+            q[1] = (uint8_t)((q[1] * (255 - a) + c[1] * a + 127) / 255);
+            q[2] = (uint8_t)((q[2] * (255 - a) + c[2] * a + 127) / 255);
+        }
+    }
+}
+
+/*
+* Blend the paint over count pixels of the row y from x, dst and cover are at the pixel x.
+* Only the runs of nonzero coverage are painted. rgb is a scratch of 3 * count bytes.
+*/
+static void paint_blend_row(const Paint* p, uint8_t* dst, int comp, const uint8_t* cover, int x, int count, int y, uint8_t* rgb)
+{
+    int i = 0;
+    while(i < count)
+    {
+        int begin;
+        if (cover[i] == 0)
+        {
+            ++i;
+            continue;
+        }
+        begin = i;
+        while(i < count && cover[i] != 0)
+            ++i;
+        paint_span(p, x + begin, y, i - begin, rgb);
+        paint_blend_span(dst + (size_t)begin * comp, comp, cover + begin, rgb, i - begin);
+    }
+}
+
+typedef struct PaintTarget
+{
+    Canvas* canvas;
+    const Paint* paint;
+    uint8_t* rgb;
+} PaintTarget;
+
+// the pixels the sorted edges can cover, y of the edges is in the subsamples
+static CanvasRect paint_edges_rect(const Edge* e, int edge_count, int vsubsample)
+{
+    CanvasRect rect = { 0, 0, 0, 0 };
+    float x0, x1, y1;
+    if (edge_count <= 0)
+        return rect;
+    
+    x0 = x1 = e[0].x0;
+    y1 = e[0].y1;
+    for(int i = 0; i < edge_count; ++i)
+    {
+        x0 = fminf(x0, fminf(e[i].x0, e[i].x1));
+        x1 = fmaxf(x1, fmaxf(e[i].x0, e[i].x1));
+        y1 = fmaxf(y1, e[i].y1);
+    }
+    rect.x0 = (int)floorf(x0);
+    rect.y0 = (int)floorf(e[0].y0 / vsubsample);
+    rect.x1 = (int)floorf(x1) + 1;
+    rect.y1 = (int)floorf(y1 / vsubsample) + 1;
+    return rect;
+}
+
+static int paint_canvas_sink(void* user, int y, const uint8_t* row)
+{
+    PaintTarget* target = (PaintTarget*)user;
+    Canvas* canvas = target->canvas;
+    int x = 0;
+    
+    // per contiguous run of the canvas, and a run without coverage doesn't touch its tile
+    while(x < canvas->w)
+    {
+        int count = canvas_row_span(canvas, x);
+        int i = 0;
+        while(i < count && row[x + i] == 0)
+            ++i;
+        if (i < count)
+        {
+            uint8_t* p = canvas_pixel(canvas, x, y);
+            if (p)
+                paint_blend_row(target->paint, p, canvas->comp, row + x, x, count, y, target->rgb);
+        }
+        x += count;
+    }
+    return 1;
+}
+
+/*
+* NOTE(chan) : canvas_rasterize1_sorted_edges_fill_rule with a paint, blended over the canvas
+* (1 component for gray, 3 or 4 for RGB) instead of writing the coverage.
+* Nothing is painted if the color scratch of a row can't be allocated.
+*/
+void canvas_rasterize1_sorted_edges_paint(Canvas* canvas, Edge* e, int edge_count, int vsubsample, FillRule rule, const Paint* paint)
+{
+    PaintTarget target;
+    target.canvas = canvas;
+    target.paint = paint;
+    target.rgb = (uint8_t*)SCANLINE_MALLOC((size_t)canvas->w * 3);
+    if (target.rgb == NULL)
+        return;
+    canvas_mark_dirty(canvas, paint_edges_rect(e, edge_count, vsubsample));
+    rasterize1_sorted_edges_to_sink(canvas->w, canvas->h, e, edge_count, vsubsample, rule, paint_canvas_sink, &target);
+    SCANLINE_FREE(target.rgb);
+}
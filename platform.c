@@ -0,0 +1,324 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Thin wrappers over the OS, so the other files don't have to know
+* whether they are running on Win32 or on pthreads.
+* Keep this file small. Only add what the rasterizer actually needs.
+*/
+
+// releases the per thread caches of the other files before a thread_create thread exits (see rasterize1.c)
+static void thread_release_locals(void);
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_entry(LPVOID arg)
+{
+    Thread* t = (Thread*)arg;
+    DWORD result = (DWORD)t->proc(t->arg);
+    thread_release_locals();
+    return result;
+}
+
+int thread_create(Thread* t, ThreadProc proc, void* arg)
+{
+    t->proc = proc;
+    t->arg = arg;
+    t->handle = CreateThread(NULL, 0, thread_entry, t, 0, NULL);
+    return t->handle != NULL;
+}
+
+void thread_join(Thread* t)
+{
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+}
+
+int thread_hardware_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+void mutex_init(Mutex* m) { InitializeSRWLock(m); }
+void mutex_destroy(Mutex* m) { (void)m; }
+void mutex_lock(Mutex* m) { AcquireSRWLockExclusive(m); }
+void mutex_unlock(Mutex* m) { ReleaseSRWLockExclusive(m); }
+
+void cond_init(CondVar* c) { InitializeConditionVariable(c); }
+void cond_destroy(CondVar* c) { (void)c; }
+void cond_wait(CondVar* c, Mutex* m) { SleepConditionVariableSRW(c, m, INFINITE, 0); }
+// returns 0 on timeout, wakes up spuriously like cond_wait
+int cond_wait_timeout(CondVar* c, Mutex* m, double seconds) { return SleepConditionVariableSRW(c, m, (DWORD)(seconds * 1000.0), 0) != 0; }
+void cond_signal(CondVar* c) { WakeConditionVariable(c); }
+void cond_broadcast(CondVar* c) { WakeAllConditionVariable(c); }
+
+// returns the value before the addition
+int atomic_fetch_add_int(volatile int* p, int v) { return (int)InterlockedExchangeAdd((volatile LONG*)p, v); }
+
+// create (or truncate) file_name with size bytes of zeros and map it for reading and writing
+int mapped_file_create(MappedFile* m, const char* file_name, size_t size)
+{
+    m->file = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m->file == INVALID_HANDLE_VALUE)
+        return 0;
+    
+    m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+    if (m->mapping == NULL)
+    {
+        CloseHandle(m->file);
+        return 0;
+    }
+    
+    m->data = (uint8_t*)MapViewOfFile(m->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (m->data == NULL)
+    {
+        CloseHandle(m->mapping);
+        CloseHandle(m->file);
+        return 0;
+    }
+    
+    m->size = size;
+    return 1;
+}
+
+// write the dirty pages back to the file
+int mapped_file_flush(MappedFile* m) { return FlushViewOfFile(m->data, m->size) != 0; }
+
+// map an existing file for reading
+int mapped_file_open_read(MappedFile* m, const char* file_name)
+{
+    LARGE_INTEGER size;
+    
+    m->file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m->file == INVALID_HANDLE_VALUE)
+        return 0;
+    
+    if (!GetFileSizeEx(m->file, &size) || size.QuadPart == 0 || (uint64_t)size.QuadPart > (uint64_t)SIZE_MAX)
+    {
+        CloseHandle(m->file);
+        return 0;
+    }
+    
+    m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m->mapping == NULL)
+    {
+        CloseHandle(m->file);
+        return 0;
+    }
+    
+    m->data = (uint8_t*)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m->data == NULL)
+    {
+        CloseHandle(m->mapping);
+        CloseHandle(m->file);
+        return 0;
+    }
+    
+    m->size = (size_t)size.QuadPart;
+    return 1;
+}
+
+void mapped_file_close(MappedFile* m)
+{
+    UnmapViewOfFile(m->data);
+    CloseHandle(m->mapping);
+    CloseHandle(m->file);
+}
+
+// monotonic time in seconds
+double time_now(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+#else
+
+static void* thread_entry(void* arg)
+{
+    Thread* t = (Thread*)arg;
+    t->proc(t->arg);
+    thread_release_locals();
+    return NULL;
+}
+
+int thread_create(Thread* t, ThreadProc proc, void* arg)
+{
+    t->proc = proc;
+    t->arg = arg;
+    return pthread_create(&t->handle, NULL, thread_entry, t) == 0;
+}
+
+void thread_join(Thread* t)
+{
+    pthread_join(t->handle, NULL);
+}
+
+int thread_hardware_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+void mutex_init(Mutex* m) { pthread_mutex_init(m, NULL); }
+void mutex_destroy(Mutex* m) { pthread_mutex_destroy(m); }
+void mutex_lock(Mutex* m) { pthread_mutex_lock(m); }
+void mutex_unlock(Mutex* m) { pthread_mutex_unlock(m); }
+
+void cond_init(CondVar* c) { pthread_cond_init(c, NULL); }
+void cond_destroy(CondVar* c) { pthread_cond_destroy(c); }
+void cond_wait(CondVar* c, Mutex* m) { pthread_cond_wait(c, m); }
+
+int cond_wait_timeout(CondVar* c, Mutex* m, double seconds)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts); // pthread_cond_timedwait takes an absolute CLOCK_REALTIME time
+    ts.tv_sec += (time_t)seconds;
+    ts.tv_nsec += (long)((seconds - (double)(time_t)seconds) * 1e9);
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(c, m, &ts) == 0;
+}
+void cond_signal(CondVar* c) { pthread_cond_signal(c); }
+void cond_broadcast(CondVar* c) { pthread_cond_broadcast(c); }
+
+// returns the value before the addition
+int atomic_fetch_add_int(volatile int* p, int v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+
+int mapped_file_create(MappedFile* m, const char* file_name, size_t size)
+{
+    m->fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m->fd < 0)
+        return 0;
+    
+    if (ftruncate(m->fd, (off_t)size) != 0)
+    {
+        close(m->fd);
+        return 0;
+    }
+    
+    m->data = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+    if (m->data == (uint8_t*)MAP_FAILED)
+    {
+        close(m->fd);
+        return 0;
+    }
+    
+    m->size = size;
+    return 1;
+}
+
+int mapped_file_flush(MappedFile* m) { return msync(m->data, m->size, MS_SYNC) == 0; }
+
+int mapped_file_open_read(MappedFile* m, const char* file_name)
+{
+    struct stat st;
+    
+    m->fd = open(file_name, O_RDONLY);
+    if (m->fd < 0)
+        return 0;
+    
+    if (fstat(m->fd, &st) != 0 || st.st_size == 0 || (uint64_t)st.st_size > (uint64_t)SIZE_MAX)
+    {
+        close(m->fd);
+        return 0;
+    }
+    
+    m->data = (uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, m->fd, 0);
+    if (m->data == (uint8_t*)MAP_FAILED)
+    {
+        close(m->fd);
+        return 0;
+    }
+    
+    m->size = (size_t)st.st_size;
+    return 1;
+}
+
+void mapped_file_close(MappedFile* m)
+{
+    munmap(m->data, m->size);
+    close(m->fd);
+}
+
+// monotonic time in seconds
+double time_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+#endif
+
+/*
+* NOTE(chan) : parallel_for calls proc(user, index) for every index in [0, count).
+* The workers take the next index from a shared counter, so expensive indices
+* don't leave the other threads idle. The calling thread works too.
+*/
+typedef struct ParallelFor
+{
+    ParallelForProc proc;
+    void* user;
+    int count;
+    volatile int next;
+} ParallelFor;
+
+static int parallel_for_worker(void* arg)
+{
+    ParallelFor* pf = (ParallelFor*)arg;
+    for(;;)
+    {
+        int index = atomic_fetch_add_int(&pf->next, 1);
+        if (index >= pf->count)
+            break;
+        pf->proc(pf->user, index);
+    }
+    return 0;
+}
+
+void parallel_for(int count, int thread_count, ParallelForProc proc, void* user)
+{
+    ParallelFor pf;
+    Thread* threads;
+    int i, spawned = 0;
+    
+    if (thread_count <= 0)
+        thread_count = thread_hardware_count();
+    if (thread_count > count)
+        thread_count = count;
+    
+    pf.proc = proc;
+    pf.user = user;
+    pf.count = count;
+    pf.next = 0;
+    
+    if (thread_count <= 1)
+    {
+        parallel_for_worker(&pf);
+        return;
+    }
+    
+    threads = (Thread*)SCANLINE_MALLOC(sizeof(Thread) * (thread_count - 1));
+    for(i = 0; i < thread_count - 1; ++i)
+    {
+        if (!thread_create(threads + spawned, parallel_for_worker, &pf))
+            break;
+        ++spawned;
+    }
+    
+    parallel_for_worker(&pf);
+    
+    for(i = 0; i < spawned; ++i)
+        thread_join(threads + i);
+    
+    SCANLINE_FREE(threads);
+}
@@ -0,0 +1,1136 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Speed oriented PNG encoder.
+* stbi_write_png filters every row with the five PNG filters and keeps the best one by a heuristic,
+* then compresses with a hash chain deflate. It takes longer than the rasterization on a large canvas.
+* Here the rows use one fixed filter, and the deflate is one of
+* - stored blocks : just copies.
+* - RLE : matches at distance 1 only. Coverage images are mostly runs of 0 and 255,
+*   and the Sub / Up filters turn them into runs of 0.
+* - fast : greedy LZ77, one probe in a hash table of the last position of each 3-byte prefix.
+* All of them use the fixed Huffman codes, so no code tables are built or written.
+* 
+* The deflate works on a buffer of filtered rows and can match into bytes before it (history),
+* so the encoders that work on row strips can share it.
+*/
+#define PNG_HASH_BITS 15
+#define PNG_HASH_SIZE (1 << PNG_HASH_BITS)
+#define PNG_WINDOW 32768
+#define PNG_MIN_MATCH 3
+#define PNG_MAX_MATCH 258
+#define PNG_STORED_MAX 65535
+
+static const uint16_t PNG_LENGTH_BASE[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+static const uint8_t PNG_LENGTH_EXTRA[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const uint16_t PNG_DIST_BASE[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+static const uint8_t PNG_DIST_EXTRA[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+/*
+* Tables built once by png_init_tables.
+* The Huffman codes are stored bit reversed, because deflate packs them from the most significant bit
+* into a stream that is filled from the least significant bit.
+*/
+static uint16_t g_png_lit_code[288];
+static uint8_t g_png_lit_bits[288];
+static uint8_t g_png_dist_code[30];
+static uint8_t g_png_length_symbol[PNG_MAX_MATCH + 1]; // length -> index into PNG_LENGTH_BASE
+static uint8_t g_png_dist_symbol[512]; // see png_dist_symbol
+static uint32_t g_png_crc_table[256];
+static volatile int g_png_tables_ready;
+
+static uint32_t png_reverse_bits(uint32_t code, int bits)
+{
+    uint32_t r = 0;
+    for(int i = 0; i < bits; ++i)
+    {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+/*
+* NOTE(chan) : Call this before the threads start encoding.
+* Every call writes the same values, but we don't want to rely on that.
+*/
+static void png_init_tables(void)
+{
+    int i, sym;
+    
+    if (g_png_tables_ready)
+        return;
+    
+    // RFC 1951 3.2.6 fixed Huffman codes
+    for(i = 0; i < 288; ++i)
+    {
+        uint32_t code;
+        int bits;
+        if (i < 144) { code = 0x30 + i; bits = 8; }
+        else if (i < 256) { code = 0x190 + (i - 144); bits = 9; }
+        else if (i < 280) { code = i - 256; bits = 7; }
+        else { code = 0xC0 + (i - 280); bits = 8; }
+        g_png_lit_code[i] = (uint16_t)png_reverse_bits(code, bits);
+        g_png_lit_bits[i] = (uint8_t)bits;
+    }
+    for(i = 0; i < 30; ++i)
+        g_png_dist_code[i] = (uint8_t)png_reverse_bits(i, 5);
+    
+    for(sym = 0, i = PNG_MIN_MATCH; i <= PNG_MAX_MATCH; ++i)
+    {
+        while(sym < 28 && PNG_LENGTH_BASE[sym + 1] <= i)
+            ++sym;
+        g_png_length_symbol[i] = (uint8_t)sym;
+    }
+    
+    // the same trick as zlib : distances up to 256 directly, and the bigger ones by (dist - 1) >> 7
+    for(sym = 0, i = 1; i <= 256; ++i)
+    {
+        while(sym < 29 && PNG_DIST_BASE[sym + 1] <= i)
+            ++sym;
+        g_png_dist_symbol[i - 1] = (uint8_t)sym;
+    }
+    for(i = 256; i < 512; ++i)
+    {
+        int dist = ((i - 256) << 7) + 1;
+        for(sym = 0; sym < 29 && PNG_DIST_BASE[sym + 1] <= dist; ++sym) {}
+        g_png_dist_symbol[i] = (uint8_t)sym;
+    }
+    
+    for(i = 0; i < 256; ++i)
+    {
+        uint32_t c = (uint32_t)i;
+        for(int k = 0; k < 8; ++k)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        g_png_crc_table[i] = c;
+    }
+    
+    g_png_tables_ready = 1;
+}
+
+static int png_dist_symbol(int dist)
+{
+    return dist <= 256 ? g_png_dist_symbol[dist - 1] : g_png_dist_symbol[256 + ((dist - 1) >> 7)];
+}
+
+static uint32_t png_crc32_update(uint32_t crc, const uint8_t* p, size_t len)
+{
+    crc = ~crc;
+    for(size_t i = 0; i < len; ++i)
+        crc = g_png_crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t png_adler32_update(uint32_t adler, const uint8_t* p, size_t len)
+{
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+    while(len)
+    {
+        // NOTE(chan) : 5552 is the most bytes we can sum before b overflows 32 bits.
+        size_t n = len < 5552 ? len : 5552;
+        len -= n;
+        while(n--)
+        {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void png_buffer_reserve(PngBuffer* b, size_t extra)
+{
+    if (b->len + extra > b->capacity)
+    {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        while(capacity < b->len + extra)
+            capacity *= 2;
+        b->data = (uint8_t*)SCANLINE_REALLOC(b->data, capacity);
+        b->capacity = capacity;
+    }
+}
+
+static void png_buffer_free(PngBuffer* b)
+{
+    SCANLINE_FREE(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+static void png_put_bytes(PngBuffer* b, const void* data, size_t len)
+{
+    png_buffer_reserve(b, len);
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void png_put_u32_be(PngBuffer* b, uint32_t v)
+{
+    uint8_t bytes[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    png_put_bytes(b, bytes, 4);
+}
+
+// the caller reserves the space, bit writing is in the hot loop
+static void png_put_bits(PngBuffer* b, uint32_t value, int count)
+{
+    b->bits |= value << b->bit_count;
+    b->bit_count += count;
+    while(b->bit_count >= 8)
+    {
+        b->data[b->len++] = (uint8_t)b->bits;
+        b->bits >>= 8;
+        b->bit_count -= 8;
+    }
+}
+
+static void png_align_bits(PngBuffer* b)
+{
+    if (b->bit_count > 0)
+        png_put_bits(b, 0, 8 - b->bit_count);
+}
+
+static void png_put_literal(PngBuffer* b, int c)
+{
+    png_put_bits(b, g_png_lit_code[c], g_png_lit_bits[c]);
+}
+
+static void png_put_match(PngBuffer* b, int length, int dist)
+{
+    int ls = g_png_length_symbol[length];
+    int ds = png_dist_symbol(dist);
+    png_put_bits(b, g_png_lit_code[257 + ls], g_png_lit_bits[257 + ls]);
+    if (PNG_LENGTH_EXTRA[ls])
+        png_put_bits(b, length - PNG_LENGTH_BASE[ls], PNG_LENGTH_EXTRA[ls]);
+    png_put_bits(b, g_png_dist_code[ds], 5);
+    if (PNG_DIST_EXTRA[ds])
+        png_put_bits(b, dist - PNG_DIST_BASE[ds], PNG_DIST_EXTRA[ds]);
+}
+
+static int png_match_length(const uint8_t* a, const uint8_t* b, int max_length)
+{
+    int n = 0;
+    while(n < max_length && a[n] == b[n])
+        ++n;
+    return n;
+}
+
+static uint32_t png_hash3(const uint8_t* p)
+{
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (v * 2654435761u) >> (32 - PNG_HASH_BITS);
+}
+
+/*
+* Compress data[0, len) as deflate blocks into b.
+* Matches can reach up to history bytes before data, and the hash table (PNG_HASH_SIZE entries)
+* keeps positions relative to data - history, so pass a fresh table (all -1) with each new history base.
+* If final is 0, the stream ends on a byte boundary with an empty stored block (a sync flush),
+* so another deflate stream can be appended to it.
+*/
+static void png_deflate(PngBuffer* b, const uint8_t* data, size_t len, size_t history, PngLevel level, int final, int32_t* hash)
+{
+    size_t i;
+    
+    if (level == PNG_LEVEL_STORED)
+    {
+        size_t pos = 0;
+        png_buffer_reserve(b, len + (len / PNG_STORED_MAX + 2) * 6);
+        do
+        {
+            size_t n = len - pos < PNG_STORED_MAX ? len - pos : PNG_STORED_MAX;
+            int last = (pos + n == len);
+            png_put_bits(b, (last && final) ? 1 : 0, 1);
+            png_put_bits(b, 0, 2); // BTYPE 00 : stored
+            png_align_bits(b);
+            png_put_bits(b, (uint32_t)n, 16);
+            png_put_bits(b, (uint32_t)(~n & 0xffff), 16);
+            memcpy(b->data + b->len, data + pos, n);
+            b->len += n;
+            pos += n;
+        } while(pos < len);
+        
+        // stored blocks end on a byte boundary, there is no need to flush.
+        return;
+    }
+    
+    // worst case : every byte is a 9 bit literal
+    png_buffer_reserve(b, len + len / 8 + 16);
+    png_put_bits(b, final ? 1 : 0, 1);
+    png_put_bits(b, 1, 2); // BTYPE 01 : fixed Huffman
+    
+    if (level == PNG_LEVEL_RLE)
+    {
+        i = 0;
+        if (history == 0 && len > 0)
+            png_put_literal(b, data[i++]);
+        
+        while(i < len)
+        {
+            int max_length = (len - i) < PNG_MAX_MATCH ? (int)(len - i) : PNG_MAX_MATCH;
+            int n = png_match_length(data + i, data + i - 1, max_length);
+            if (n >= PNG_MIN_MATCH)
+            {
+                png_put_match(b, n, 1);
+                i += n;
+            }
+            else
+                png_put_literal(b, data[i++]);
+        }
+    }
+    else
+    {
+        const uint8_t* base = data - history;
+        
+        i = 0;
+        while(i < len)
+        {
+            size_t pos = history + i;
+            if (i + PNG_MIN_MATCH <= len)
+            {
+                uint32_t h = png_hash3(data + i);
+                int32_t candidate = hash[h];
+                hash[h] = (int32_t)pos;
+                
+                if (candidate >= 0 && pos - (size_t)candidate <= PNG_WINDOW)
+                {
+                    int max_length = (len - i) < PNG_MAX_MATCH ? (int)(len - i) : PNG_MAX_MATCH;
+                    int n = png_match_length(data + i, base + candidate, max_length);
+                    if (n >= PNG_MIN_MATCH)
+                    {
+                        png_put_match(b, n, (int)(pos - (size_t)candidate));
+                        i += n;
+                        continue;
+                    }
+                }
+            }
+            png_put_literal(b, data[i++]);
+        }
+    }
+    
+    png_put_bits(b, g_png_lit_code[256], g_png_lit_bits[256]); // end of block
+    
+    if (!final)
+    {
+        // NOTE(chan) : sync flush, an empty stored block to get back to a byte boundary.
+        png_put_bits(b, 0, 3);
+        png_align_bits(b);
+        png_put_bits(b, 0x0000, 16);
+        png_put_bits(b, 0xffff, 16);
+    }
+    else
+        png_align_bits(b);
+}
+
+/*
+* Filter one row into dst, dst[0] is the filter type.
+* prior is the previous row, or NULL for the first row.
+*/
+static void png_filter_row(uint8_t* dst, const uint8_t* row, const uint8_t* prior, int row_bytes, int bpp, PngFilter filter)
+{
+    int i;
+    
+    if (filter == PNG_FILTER_UP && prior == NULL)
+        filter = PNG_FILTER_NONE; // Up of the first row is None
+    
+    dst[0] = (uint8_t)filter;
+    ++dst;
+    
+    switch(filter)
+    {
+        case PNG_FILTER_SUB:
+        {
+            for(i = 0; i < bpp && i < row_bytes; ++i)
+                dst[i] = row[i];
+            for(; i < row_bytes; ++i)
+                dst[i] = (uint8_t)(row[i] - row[i - bpp]);
+        } break;
+        
+        case PNG_FILTER_UP:
+        {
+            i = 0;
+#ifdef SCANLINE_SSE2
+            for(; i + 16 <= row_bytes; i += 16)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i*)(row + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(prior + i));
+                _mm_storeu_si128((__m128i*)(dst + i), _mm_sub_epi8(a, b));
+            }
+#endif
+            for(; i < row_bytes; ++i)
+                dst[i] = (uint8_t)(row[i] - prior[i]);
+        } break;
+        
+        default:
+        {
+            memcpy(dst, row, row_bytes);
+        } break;
+    }
+}
+
+static void png_put_chunk(PngBuffer* out, const char* type, const uint8_t* data, size_t len)
+{
+    uint32_t crc;
+    png_put_u32_be(out, (uint32_t)len);
+    png_put_bytes(out, type, 4);
+    if (len)
+        png_put_bytes(out, data, len);
+    crc = png_crc32_update(0, (const uint8_t*)type, 4);
+    crc = png_crc32_update(crc, data, len);
+    png_put_u32_be(out, crc);
+}
+
+static void png_put_header(PngBuffer* out, int w, int h, int comp)
+{
+    static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    static const uint8_t color_types[5] = { 0, 0, 4, 2, 6 }; // by the number of components
+    uint8_t ihdr[13];
+    
+    png_put_bytes(out, signature, 8);
+    
+    ihdr[0] = (uint8_t)(w >> 24); ihdr[1] = (uint8_t)(w >> 16); ihdr[2] = (uint8_t)(w >> 8); ihdr[3] = (uint8_t)w;
+    ihdr[4] = (uint8_t)(h >> 24); ihdr[5] = (uint8_t)(h >> 16); ihdr[6] = (uint8_t)(h >> 8); ihdr[7] = (uint8_t)h;
+    ihdr[8] = 8; // bit depth
+    ihdr[9] = color_types[comp];
+    ihdr[10] = 0; // compression
+    ihdr[11] = 0; // filter method
+    ihdr[12] = 0; // no interlace
+    png_put_chunk(out, "IHDR", ihdr, 13);
+}
+
+static void png_put_end(PngBuffer* out)
+{
+    png_put_chunk(out, "IEND", NULL, 0);
+}
+
+/*
+* Encode the pixels into a PNG file in memory. The caller frees out->data with SCANLINE_FREE.
+*/
+void png_encode(PngBuffer* out, const uint8_t* pixels, int w, int h, int comp, size_t stride, PngOptions* options)
+{
+    size_t row_bytes = (size_t)w * comp;
+    size_t filtered_len = (row_bytes + 1) * h;
+    uint8_t* filtered = (uint8_t*)SCANLINE_MALLOC(filtered_len);
+    int32_t* hash = NULL;
+    PngBuffer z = {0};
+    uint32_t adler;
+    
+    png_init_tables();
+    memset(out, 0, sizeof(*out));
+    
+    for(int y = 0; y < h; ++y)
+    {
+        const uint8_t* row = pixels + stride * y;
+        png_filter_row(filtered + (row_bytes + 1) * y, row, y > 0 ? row - stride : NULL, (int)row_bytes, comp, options->filter);
+    }
+    
+    if (options->level == PNG_LEVEL_FAST)
+    {
+        hash = (int32_t*)SCANLINE_MALLOC(sizeof(int32_t) * PNG_HASH_SIZE);
+        memset(hash, 0xff, sizeof(int32_t) * PNG_HASH_SIZE);
+    }
+    
+    // zlib stream : header, deflate, adler32
+    png_buffer_reserve(&z, 2);
+    z.data[z.len++] = 0x78;
+    z.data[z.len++] = 0x01;
+    png_deflate(&z, filtered, filtered_len, 0, options->level, 1, hash);
+    adler = png_adler32_update(1, filtered, filtered_len);
+    png_put_u32_be(&z, adler);
+    
+    png_put_header(out, w, h, comp);
+    png_put_chunk(out, "IDAT", z.data, z.len);
+    png_put_end(out);
+    
+    png_buffer_free(&z);
+    SCANLINE_FREE(hash);
+    SCANLINE_FREE(filtered);
+}
+
+static int png_write_file(const char* file_name, PngBuffer* png)
+{
+    FILE* f = fopen(file_name, "wb");
+    size_t written;
+    if (f == NULL)
+        return 0;
+    written = fwrite(png->data, 1, png->len, f);
+    fclose(f);
+    return written == png->len;
+}
+
+/*
+* NOTE(chan) : Parallel PNG encoding.
+* The rows are split into strips, and every strip is filtered and deflated on its own thread.
+* A strip doesn't match into the previous strip, and every strip except the last one
+* ends on a sync flush, so the compressed strips joined together are one valid deflate stream.
+* The checksums are combined from the per strip ones instead of running over the whole stream again.
+* - Adler-32 of the zlib stream : png_adler32_combine of the strip Adler-32s.
+* - CRC of the IDAT chunk : png_crc32_combine of the strip CRCs.
+* The Up filter of the first row of a strip reads the last row of the previous strip from the canvas,
+* so the filtered bytes are the same as the single threaded encoder.
+* A tiled canvas is read row by row with canvas_read_row, so it isn't copied to a linear canvas.
+*
+* The strips don't depend on each other, so canvas_save_png_cached keeps them (PngStripCache),
+* and encodes again only the strips with a dirty row, or with a dirty row just above them for the filter.
+*/
+#define PNG_STRIP_MIN_BYTES (256 * 1024) // smaller strips lose too much of the LZ window
+#define PNG_STRIP_MAX_BYTES (64 * 1024 * 1024) // keeps an IDAT chunk under 2^31 bytes with a few strips
+#define PNG_CHUNK_MAX_BYTES 0x7fffffffu
+
+typedef struct PngStrip
+{
+    int y0, y1;
+    PngBuffer z;
+    size_t filtered_len;
+    uint32_t adler;
+    uint32_t crc;
+    int valid; // z is up to date, the strip is skipped
+} PngStrip;
+
+typedef struct PngParallel
+{
+    const uint8_t* pixels; // NULL for a tiled canvas
+    const Canvas* canvas;
+    int w, h, comp;
+    size_t stride;
+    PngOptions* options;
+    PngStrip* strips;
+    int strip_count;
+} PngParallel;
+
+// zlib's adler32_combine : the Adler-32 of A + B from the ones of A and B, and the length of B
+static uint32_t png_adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2)
+{
+    const uint32_t base = 65521;
+    uint32_t rem = (uint32_t)(len2 % base);
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % base);
+    
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= (base << 1)) sum2 -= (base << 1);
+    if (sum2 >= base) sum2 -= base;
+    return sum1 | (sum2 << 16);
+}
+
+static uint32_t png_gf2_matrix_times(const uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    while(vec)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        ++mat;
+    }
+    return sum;
+}
+
+static void png_gf2_matrix_square(uint32_t* square, const uint32_t* mat)
+{
+    for(int n = 0; n < 32; ++n)
+        square[n] = png_gf2_matrix_times(mat, mat[n]);
+}
+
+/*
+* zlib's crc32_combine : the CRC of A + B from the ones of A and B, and the length of B.
+* Appending len2 zero bytes to A is a linear operator on the CRC register,
+* so it is applied by squaring the operator of one zero bit, in O(log(len2)).
+*/
+static uint32_t png_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+    uint32_t even[32], odd[32];
+    uint32_t row = 1;
+    
+    if (len2 == 0)
+        return crc1;
+    
+    odd[0] = 0xEDB88320u; // the operator of one zero bit
+    for(int n = 1; n < 32; ++n)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+    
+    png_gf2_matrix_square(even, odd); // 2 zero bits
+    png_gf2_matrix_square(odd, even); // 4 zero bits
+    
+    // the first squaring below is for one zero byte
+    do
+    {
+        png_gf2_matrix_square(even, odd);
+        if (len2 & 1)
+            crc1 = png_gf2_matrix_times(even, crc1);
+        len2 >>= 1;
+        if (len2 == 0)
+            break;
+        
+        png_gf2_matrix_square(odd, even);
+        if (len2 & 1)
+            crc1 = png_gf2_matrix_times(odd, crc1);
+        len2 >>= 1;
+    } while(len2);
+    
+    return crc1 ^ crc2;
+}
+
+static void png_encode_strip(void* user, int index)
+{
+    PngParallel* pp = (PngParallel*)user;
+    PngStrip* strip = pp->strips + index;
+    size_t row_bytes = (size_t)pp->w * pp->comp;
+    uint8_t* filtered;
+    int32_t* hash = NULL;
+    TRACE_DECL(trace_strip);
+    
+    if (strip->valid)
+        return;
+    
+    TRACE_BEGIN_ARG(trace_strip, "png strip", strip->y0);
+    
+    strip->filtered_len = (row_bytes + 1) * (strip->y1 - strip->y0);
+    filtered = (uint8_t*)SCANLINE_MALLOC(strip->filtered_len);
+    if (pp->pixels)
+    {
+        for(int y = strip->y0; y < strip->y1; ++y)
+        {
+            const uint8_t* row = pp->pixels + pp->stride * y;
+            png_filter_row(filtered + (row_bytes + 1) * (y - strip->y0), row, y > 0 ? row - pp->stride : NULL, (int)row_bytes, pp->comp, pp->options->filter);
+        }
+    }
+    else
+    {
+        uint8_t* buffer = (uint8_t*)SCANLINE_MALLOC(row_bytes * 2);
+        uint8_t* row = buffer;
+        uint8_t* prior = buffer + row_bytes;
+        if (strip->y0 > 0)
+            canvas_read_row(pp->canvas, strip->y0 - 1, prior, 0);
+        for(int y = strip->y0; y < strip->y1; ++y)
+        {
+            uint8_t* t;
+            canvas_read_row(pp->canvas, y, row, 0);
+            png_filter_row(filtered + (row_bytes + 1) * (y - strip->y0), row, y > 0 ? prior : NULL, (int)row_bytes, pp->comp, pp->options->filter);
+            t = row, row = prior, prior = t;
+        }
+        SCANLINE_FREE(buffer);
+    }
+    
+    if (pp->options->level == PNG_LEVEL_FAST)
+    {
+        hash = (int32_t*)SCANLINE_MALLOC(sizeof(int32_t) * PNG_HASH_SIZE);
+        memset(hash, 0xff, sizeof(int32_t) * PNG_HASH_SIZE);
+    }
+    
+    memset(&strip->z, 0, sizeof(strip->z));
+    png_deflate(&strip->z, filtered, strip->filtered_len, 0, pp->options->level, index == pp->strip_count - 1, hash);
+    strip->adler = png_adler32_update(1, filtered, strip->filtered_len);
+    strip->crc = png_crc32_update(0, strip->z.data, strip->z.len);
+    
+    strip->valid = 1;
+    
+    SCANLINE_FREE(hash);
+    SCANLINE_FREE(filtered);
+    TRACE_END(trace_strip);
+}
+
+static int png_write_u32_be(FILE* f, uint32_t v)
+{
+    uint8_t bytes[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+    return fwrite(bytes, 1, 4, f) == 4;
+}
+
+// a few strips per thread for the load balance, but not too small for the compression
+static int png_strip_rows(const Canvas* canvas, int thread_count)
+{
+    size_t row_bytes = (size_t)canvas->w * canvas->comp;
+    int rows_per_strip = (canvas->h + thread_count * 4 - 1) / (thread_count * 4);
+    if ((size_t)rows_per_strip * (row_bytes + 1) < PNG_STRIP_MIN_BYTES)
+        rows_per_strip = (int)(PNG_STRIP_MIN_BYTES / (row_bytes + 1)) + 1;
+    if ((size_t)rows_per_strip * (row_bytes + 1) > PNG_STRIP_MAX_BYTES)
+        rows_per_strip = (int)(PNG_STRIP_MAX_BYTES / (row_bytes + 1));
+    if (rows_per_strip < 1)
+        rows_per_strip = 1;
+    return rows_per_strip;
+}
+
+static void png_parallel_init(PngParallel* pp, const Canvas* canvas, PngOptions* options, PngStrip* strips, int strip_count)
+{
+    pp->pixels = canvas->tiles ? NULL : canvas->p;
+    pp->canvas = canvas;
+    pp->w = canvas->w;
+    pp->h = canvas->h;
+    pp->comp = canvas->comp;
+    pp->stride = (size_t)canvas->w * canvas->comp;
+    pp->options = options;
+    pp->strips = strips;
+    pp->strip_count = strip_count;
+}
+
+// the file of the encoded strips, returns 0 if it can't be written
+static int png_write_strips(const char* file_name, const Canvas* canvas, const PngStrip* strips, int strip_count)
+{
+    static const uint8_t zlib_header[2] = { 0x78, 0x01 };
+    PngBuffer head = {0};
+    uint32_t adler = 1;
+    FILE* f;
+    int ok = 1;
+    
+    for(int i = 0; i < strip_count; ++i)
+        adler = png_adler32_combine(adler, strips[i].adler, strips[i].filtered_len);
+    
+    f = fopen(file_name, "wb");
+    if (f == NULL)
+        ok = 0;
+    else
+    {
+        png_put_header(&head, canvas->w, canvas->h, canvas->comp);
+        ok = fwrite(head.data, 1, head.len, f) == head.len;
+        
+        // IDAT chunks : [zlib header] strip strip ... [adler]
+        for(int i = 0; i < strip_count && ok;)
+        {
+            uint8_t adler_bytes[4] = { (uint8_t)(adler >> 24), (uint8_t)(adler >> 16), (uint8_t)(adler >> 8), (uint8_t)adler };
+            size_t len = (i == 0) ? 2 : 0;
+            int end = i;
+            uint32_t crc;
+            
+            while(end < strip_count && len + strips[end].z.len + 4 <= PNG_CHUNK_MAX_BYTES)
+                len += strips[end++].z.len;
+            if (end == i)
+                end = i + 1, len += strips[i].z.len; // can't happen with PNG_STRIP_MAX_BYTES
+            if (end == strip_count)
+                len += 4;
+            
+            crc = png_crc32_update(0, (const uint8_t*)"IDAT", 4);
+            if (i == 0)
+                crc = png_crc32_update(crc, zlib_header, 2);
+            
+            ok = ok && png_write_u32_be(f, (uint32_t)len);
+            ok = ok && fwrite("IDAT", 1, 4, f) == 4;
+            if (i == 0)
+                ok = ok && fwrite(zlib_header, 1, 2, f) == 2;
+            for(; i < end && ok; ++i)
+            {
+                ok = fwrite(strips[i].z.data, 1, strips[i].z.len, f) == strips[i].z.len;
+                crc = png_crc32_combine(crc, strips[i].crc, strips[i].z.len);
+            }
+            if (end == strip_count)
+            {
+                ok = ok && fwrite(adler_bytes, 1, 4, f) == 4;
+                crc = png_crc32_update(crc, adler_bytes, 4);
+            }
+            ok = ok && png_write_u32_be(f, crc);
+        }
+        
+        head.len = 0;
+        png_put_end(&head);
+        ok = ok && fwrite(head.data, 1, head.len, f) == head.len;
+        fclose(f);
+    }
+    
+    png_buffer_free(&head);
+    return ok;
+}
+
+/*
+* NOTE(chan) : canvas_save_png on thread_count threads (<= 0 for all the hardware threads).
+* The strips are grouped into as few IDAT chunks as the 2^31 chunk limit allows.
+*/
+void canvas_save_png_parallel(Canvas* canvas, const char* file_name, PngOptions* options, int thread_count)
+{
+    PngOptions default_options = { PNG_FILTER_UP, PNG_LEVEL_FAST };
+    PngParallel pp;
+    PngStrip* strips;
+    int rows_per_strip, strip_count;
+    TRACE_DECL(trace_encode);
+    
+    if (options == NULL)
+        options = &default_options;
+    if (thread_count <= 0)
+        thread_count = thread_hardware_count();
+    
+    TRACE_BEGIN(trace_encode, "png encode parallel");
+    png_init_tables();
+    
+    rows_per_strip = png_strip_rows(canvas, thread_count);
+    strip_count = (canvas->h + rows_per_strip - 1) / rows_per_strip;
+    strips = (PngStrip*)SCANLINE_MALLOC(sizeof(PngStrip) * strip_count);
+    for(int i = 0; i < strip_count; ++i)
+    {
+        strips[i].y0 = i * rows_per_strip;
+        strips[i].y1 = (i + 1) * rows_per_strip < canvas->h ? (i + 1) * rows_per_strip : canvas->h;
+        strips[i].valid = 0;
+    }
+    
+    png_parallel_init(&pp, canvas, options, strips, strip_count);
+    parallel_for(strip_count, thread_count, png_encode_strip, &pp);
+    
+    if (!png_write_strips(file_name, canvas, strips, strip_count))
+        printf("Fail to save a canvas on %s\n", file_name);
+    
+    for(int i = 0; i < strip_count; ++i)
+        png_buffer_free(&strips[i].z);
+    SCANLINE_FREE(strips);
+    TRACE_END(trace_encode);
+}
+
+void png_strip_cache_free(PngStripCache* cache)
+{
+    for(int i = 0; i < cache->strip_count; ++i)
+        png_buffer_free(&cache->strips[i].z);
+    SCANLINE_FREE(cache->strips);
+    memset(cache, 0, sizeof(*cache));
+}
+
+/*
+* NOTE(chan) : canvas_save_png_parallel that keeps the encoded strips in cache for the next save of the same canvas.
+* Only the strips under the dirty rects of the canvas are encoded again, then the dirty list is cleared.
+* Writes that don't go through the library must be marked with canvas_mark_dirty (see PngStripCache).
+* A change of the size, the components or the options encodes the whole canvas.
+* The file is the same as canvas_save_png_parallel with the same strips.
+*/
+void canvas_save_png_cached(Canvas* canvas, const char* file_name, PngOptions* options, int thread_count, PngStripCache* cache)
+{
+    PngOptions default_options = { PNG_FILTER_UP, PNG_LEVEL_FAST };
+    PngParallel pp;
+    int encoded = 0;
+    TRACE_DECL(trace_encode);
+    
+    if (options == NULL)
+        options = &default_options;
+    if (thread_count <= 0)
+        thread_count = thread_hardware_count();
+    
+    png_init_tables();
+    
+    if (cache->strips == NULL || cache->w != canvas->w || cache->h != canvas->h || cache->comp != canvas->comp ||
+        cache->options.filter != options->filter || cache->options.level != options->level)
+    {
+        png_strip_cache_free(cache);
+        cache->w = canvas->w;
+        cache->h = canvas->h;
+        cache->comp = canvas->comp;
+        cache->options = *options;
+        cache->rows_per_strip = png_strip_rows(canvas, thread_count);
+        cache->strip_count = (canvas->h + cache->rows_per_strip - 1) / cache->rows_per_strip;
+        cache->strips = (PngStrip*)SCANLINE_MALLOC(sizeof(PngStrip) * cache->strip_count);
+        memset(cache->strips, 0, sizeof(PngStrip) * cache->strip_count);
+        for(int i = 0; i < cache->strip_count; ++i)
+        {
+            cache->strips[i].y0 = i * cache->rows_per_strip;
+            cache->strips[i].y1 = (i + 1) * cache->rows_per_strip < canvas->h ? (i + 1) * cache->rows_per_strip : canvas->h;
+        }
+    }
+    else
+    {
+        // the rows of a rect, and the row below it that the filter reads it from
+        for(int i = 0; i < canvas->dirty_count; ++i)
+        {
+            int y1 = canvas->dirty[i].y1 < canvas->h ? canvas->dirty[i].y1 : canvas->h - 1;
+            for(int k = canvas->dirty[i].y0 / cache->rows_per_strip; k <= y1 / cache->rows_per_strip; ++k)
+            {
+                png_buffer_free(&cache->strips[k].z);
+                cache->strips[k].valid = 0;
+            }
+        }
+    }
+    
+    for(int i = 0; i < cache->strip_count; ++i)
+        encoded += !cache->strips[i].valid;
+    
+    TRACE_BEGIN_ARG(trace_encode, "png encode cached", encoded);
+    png_parallel_init(&pp, canvas, &cache->options, cache->strips, cache->strip_count);
+    if (encoded)
+        parallel_for(cache->strip_count, thread_count, png_encode_strip, &pp);
+    
+    if (!png_write_strips(file_name, canvas, cache->strips, cache->strip_count))
+        printf("Fail to save a canvas on %s\n", file_name);
+    canvas_clear_dirty(canvas);
+    TRACE_END(trace_encode);
+}
+
+/*
+* NOTE(chan) : Streaming PNG writer.
+* png_stream_write_row copies a row into the ring and returns, unless the ring is full.
+* The consumer thread waits for a batch of rows (half of the ring), filters them behind
+* the history window, deflates the batch as non-final blocks matching into the history,
+* and writes the result as one IDAT chunk. So the memory is the ring and the window,
+* not the w x h image, and the encoding runs while the producer makes the next rows.
+*/
+#define PNG_STREAM_RING_BYTES (256 * 1024)
+
+static int png_stream_consumer(void* arg)
+{
+    PngStream* s = (PngStream*)arg;
+    size_t filtered_row = s->row_bytes + 1;
+    int consumed = 0;
+    
+    while(consumed < s->h)
+    {
+        int want = (s->h - consumed) < s->batch_rows ? (s->h - consumed) : s->batch_rows;
+        int n;
+        size_t history = s->window_len;
+        size_t len;
+        TRACE_DECL(trace_batch);
+        
+        mutex_lock(&s->mutex);
+        while(s->head - s->tail < want)
+            cond_wait(&s->not_empty, &s->mutex);
+        n = s->head - s->tail;
+        mutex_unlock(&s->mutex);
+        
+        TRACE_BEGIN_ARG(trace_batch, "png stream batch", consumed);
+        
+        // the rows [tail, tail + n) are ours until tail moves
+        if (n > s->batch_rows)
+            n = s->batch_rows;
+        for(int i = 0; i < n; ++i)
+        {
+            const uint8_t* row = s->ring + (size_t)((consumed + i) % s->ring_rows) * s->row_bytes;
+            png_filter_row(s->window + history + filtered_row * i, row, (consumed + i) > 0 ? s->prior : NULL, (int)s->row_bytes, s->comp, s->options.filter);
+            memcpy(s->prior, row, s->row_bytes);
+        }
+        
+        mutex_lock(&s->mutex);
+        s->tail += n;
+        cond_signal(&s->not_full);
+        mutex_unlock(&s->mutex);
+        
+        consumed += n;
+        len = filtered_row * n;
+        
+        s->z.len = 0;
+        if (consumed == n)
+        {
+            // zlib header
+            png_buffer_reserve(&s->z, 2);
+            s->z.data[s->z.len++] = 0x78;
+            s->z.data[s->z.len++] = 0x01;
+        }
+        png_deflate(&s->z, s->window + history, len, history, s->options.level, consumed == s->h, s->hash);
+        s->adler = png_adler32_update(s->adler, s->window + history, len);
+        if (consumed == s->h)
+            png_put_u32_be(&s->z, s->adler);
+        
+        s->chunk.len = 0;
+        png_put_chunk(&s->chunk, "IDAT", s->z.data, s->z.len);
+        if (s->ok)
+            s->ok = fwrite(s->chunk.data, 1, s->chunk.len, s->f) == s->chunk.len;
+        
+        // keep the last PNG_WINDOW bytes as the history of the next batch
+        {
+            size_t total = history + len;
+            size_t keep = total < PNG_WINDOW ? total : PNG_WINDOW;
+            size_t shift = total - keep;
+            
+            memmove(s->window, s->window + shift, keep);
+            s->window_len = keep;
+            if (s->hash && shift)
+            {
+                for(int i = 0; i < PNG_HASH_SIZE; ++i)
+                    s->hash[i] = (s->hash[i] >= (int32_t)shift) ? s->hash[i] - (int32_t)shift : -1;
+            }
+        }
+        
+        TRACE_END(trace_batch);
+    }
+    
+    return 0;
+}
+
+/*
+* Open a PNG file of w x h pixels with comp components for png_stream_write_row.
+* options can be NULL for the Up filter with the fast deflate. Returns NULL if the file can't be opened or the encoder thread can't be started.
+*/
+PngStream* png_stream_open(const char* file_name, int w, int h, int comp, PngOptions* options)
+{
+    PngOptions default_options = { PNG_FILTER_UP, PNG_LEVEL_FAST };
+    PngStream* s;
+    FILE* f = fopen(file_name, "wb");
+    if (f == NULL)
+        return NULL;
+    
+    png_init_tables();
+    
+    s = (PngStream*)SCANLINE_MALLOC(sizeof(PngStream));
+    memset(s, 0, sizeof(*s));
+    s->f = f;
+    s->w = w;
+    s->h = h;
+    s->comp = comp;
+    s->row_bytes = (size_t)w * comp;
+    s->options = options ? *options : default_options;
+    s->ok = 1;
+    s->adler = 1;
+    
+    s->ring_rows = (int)(PNG_STREAM_RING_BYTES / s->row_bytes);
+    if (s->ring_rows < 4)
+        s->ring_rows = 4;
+    if (s->ring_rows > h)
+        s->ring_rows = h > 0 ? h : 1;
+    s->batch_rows = (s->ring_rows + 1) / 2;
+    
+    s->ring = (uint8_t*)SCANLINE_MALLOC(s->row_bytes * s->ring_rows);
+    s->prior = (uint8_t*)SCANLINE_MALLOC(s->row_bytes);
+    s->window = (uint8_t*)SCANLINE_MALLOC(PNG_WINDOW + (s->row_bytes + 1) * s->batch_rows);
+    if (s->options.level == PNG_LEVEL_FAST)
+    {
+        s->hash = (int32_t*)SCANLINE_MALLOC(sizeof(int32_t) * PNG_HASH_SIZE);
+        memset(s->hash, 0xff, sizeof(int32_t) * PNG_HASH_SIZE);
+    }
+    
+    png_put_header(&s->chunk, w, h, comp);
+    s->ok = fwrite(s->chunk.data, 1, s->chunk.len, f) == s->chunk.len;
+    
+    mutex_init(&s->mutex);
+    cond_init(&s->not_full);
+    cond_init(&s->not_empty);
+    if (!thread_create(&s->thread, png_stream_consumer, s))
+    {
+        // no consumer would ever empty the ring
+        cond_destroy(&s->not_empty);
+        cond_destroy(&s->not_full);
+        mutex_destroy(&s->mutex);
+        fclose(f);
+        png_buffer_free(&s->chunk);
+        SCANLINE_FREE(s->hash);
+        SCANLINE_FREE(s->window);
+        SCANLINE_FREE(s->prior);
+        SCANLINE_FREE(s->ring);
+        SCANLINE_FREE(s);
+        return NULL;
+    }
+    return s;
+}
+
+/*
+* Append the next row (row_bytes = w * comp bytes).
+* It blocks only when the consumer is a whole ring behind.
+*/
+void png_stream_write_row(PngStream* s, const uint8_t* row)
+{
+    int slot;
+    
+    mutex_lock(&s->mutex);
+    while(s->head - s->tail == s->ring_rows)
+        cond_wait(&s->not_full, &s->mutex);
+    slot = s->head % s->ring_rows;
+    mutex_unlock(&s->mutex);
+    
+    // the consumer doesn't read the slot until head moves past it
+    memcpy(s->ring + (size_t)slot * s->row_bytes, row, s->row_bytes);
+    
+    mutex_lock(&s->mutex);
+    ++s->head;
+    cond_signal(&s->not_empty);
+    mutex_unlock(&s->mutex);
+}
+
+/*
+* Finish the file and free the stream. Missing rows are written as zeros.
+* Returns 0 if writing the file failed.
+*/
+int png_stream_close(PngStream* s)
+{
+    int ok;
+    
+    if (s->head < s->h)
+    {
+        uint8_t* zero = (uint8_t*)SCANLINE_MALLOC(s->row_bytes);
+        memset(zero, 0, s->row_bytes);
+        while(s->head < s->h)
+            png_stream_write_row(s, zero);
+        SCANLINE_FREE(zero);
+    }
+    
+    thread_join(&s->thread);
+    
+    s->chunk.len = 0;
+    png_put_end(&s->chunk);
+    if (s->ok)
+        s->ok = fwrite(s->chunk.data, 1, s->chunk.len, s->f) == s->chunk.len;
+    ok = (fclose(s->f) == 0) && s->ok;
+    
+    cond_destroy(&s->not_empty);
+    cond_destroy(&s->not_full);
+    mutex_destroy(&s->mutex);
+    png_buffer_free(&s->z);
+    png_buffer_free(&s->chunk);
+    SCANLINE_FREE(s->hash);
+    SCANLINE_FREE(s->window);
+    SCANLINE_FREE(s->prior);
+    SCANLINE_FREE(s->ring);
+    SCANLINE_FREE(s);
+    return ok;
+}
+
+// RowSinkProc for the rasterizers, user is the PngStream
+static int png_stream_row_sink(void* user, int y, const uint8_t* row)
+{
+    (void)y;
+    png_stream_write_row((PngStream*)user, row);
+    return 1;
+}
+
+/*
+* A tiled canvas goes through the stream, so it is encoded from the tiles without a linear copy.
+* canvas_read_row skips the empty tiles, and a run of empty rows reuses the same zero row.
+*/
+static void png_save_tiled(Canvas* canvas, const char* file_name, PngOptions* options)
+{
+    PngStream* stream = png_stream_open(file_name, canvas->w, canvas->h, canvas->comp, options);
+    uint8_t* row;
+    int zeroed = 0;
+    TRACE_DECL(trace_encode);
+    
+    if (stream == NULL)
+    {
+        printf("Fail to save a canvas on %s\n", file_name);
+        return;
+    }
+    
+    TRACE_BEGIN(trace_encode, "png encode tiled");
+    row = (uint8_t*)SCANLINE_MALLOC((size_t)canvas->w * canvas->comp);
+    for(int y = 0; y < canvas->h; ++y)
+    {
+        zeroed = !canvas_read_row(canvas, y, row, zeroed);
+        png_stream_write_row(stream, row);
+    }
+    SCANLINE_FREE(row);
+    
+    if (!png_stream_close(stream))
+        printf("Fail to save a canvas on %s\n", file_name);
+    TRACE_END(trace_encode);
+}
+
+/*
+* NOTE(chan) : canvas_save with the speed oriented encoder.
+* options can be NULL for the Up filter with the fast deflate.
+*/
+void canvas_save_png(Canvas* canvas, const char* file_name, PngOptions* options)
+{
+    PngOptions default_options = { PNG_FILTER_UP, PNG_LEVEL_FAST };
+    PngBuffer png;
+    TRACE_DECL(trace_encode);
+    
+    if (canvas->tiles)
+    {
+        png_save_tiled(canvas, file_name, options);
+        return;
+    }
+    
+    if (options == NULL)
+        options = &default_options;
+    
+    TRACE_BEGIN(trace_encode, "png encode fast");
+    png_encode(&png, canvas->p, canvas->w, canvas->h, canvas->comp, (size_t)canvas->w * canvas->comp, options);
+    TRACE_END(trace_encode);
+    
+    if (!png_write_file(file_name, &png))
+        printf("Fail to save a canvas on %s\n", file_name);
+    
+    png_buffer_free(&png);
+}
@@ -0,0 +1,257 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Analytic primitives (circle, ellipse, rounded rectangle).
+* Approximating a circle with a polygon costs hundreds of edges to build, sort and sweep.
+* These primitives don't need edges at all. For each row we compute where the shape starts and ends:
+* - the inner span : the pixel centers at least half a pixel inside, fully covered.
+* - the outer span : the pixel centers less than half a pixel outside, partially covered.
+* Only the pixels between the two spans evaluate the distance d from their center to the boundary,
+* and the coverage is clamp(0.5 - d, 0, 1), a one pixel wide ramp across the boundary.
+* 
+* The coverage is composited over the canvas (source-over), so overlapping dots in
+* a scatter plot don't erase each other. The canvas should have 1 component,
+* the same as canvas_rasterize1_sorted_edges.
+*/
+typedef enum PrimType
+{
+    PRIM_ELLIPSE,
+    PRIM_ROUND_RECT
+} PrimType;
+
+typedef struct PrimShape
+{
+    PrimType type;
+    float cx, cy; // center
+    float hx, hy; // half size (radii for the ellipse)
+    float r;      // corner radius of the rounded rectangle
+} PrimShape;
+
+// signed distance, negative inside
+static float prim_distance(PrimShape* s, float px, float py)
+{
+    float x = px - s->cx;
+    float y = py - s->cy;
+    
+    if (s->type == PRIM_ELLIPSE)
+    {
+        if (s->hx == s->hy)
+            return sqrtf(x * x + y * y) - s->hx;
+        else
+        {
+            // NOTE(chan) : first order approximation f / |grad f| with f = x^2/a^2 + y^2/b^2 - 1.
+            // It is exact on the boundary, which is where the coverage ramp is.
+            float ia2 = 1.f / (s->hx * s->hx);
+            float ib2 = 1.f / (s->hy * s->hy);
+            float f = x * x * ia2 + y * y * ib2 - 1.f;
+            float gx = 2.f * x * ia2;
+            float gy = 2.f * y * ib2;
+            float g = sqrtf(gx * gx + gy * gy);
+            return g > 0.f ? f / g : -s->hx;
+        }
+    }
+    else
+    {
+        float qx = fabsf(x) - (s->hx - s->r);
+        float qy = fabsf(y) - (s->hy - s->r);
+        float ox = qx > 0.f ? qx : 0.f;
+        float oy = qy > 0.f ? qy : 0.f;
+        float in = qx > qy ? qx : qy;
+        return sqrtf(ox * ox + oy * oy) + (in < 0.f ? in : 0.f) - s->r;
+    }
+}
+
+/*
+* The size of the shape grown by half a pixel (outer != 0) or shrunk by half a pixel (outer == 0).
+* The pixel centers inside the grown shape have some coverage,
+* and the ones inside the shrunk shape have full coverage.
+*/
+static void prim_offset_size(PrimShape* s, int outer, float* out_hx, float* out_hy, float* out_r)
+{
+    float k = outer ? 0.5f : -0.5f;
+    
+    if (s->type == PRIM_ELLIPSE && s->hx != s->hy)
+    {
+        /*
+        * NOTE(chan) : The offset of an ellipse is not an ellipse, so we scale the ellipse by q instead.
+        * On the ellipse scaled by q, the approximate distance of prim_distance is
+        * (q^2 - 1) / (2q |g|) with |g| <= 1 / min(a, b). So it crosses +-0.5 between the ellipses
+        * scaled by q = +-m + sqrt(m^2 + 1) with m = 0.5 / min(a, b).
+        */
+        float m = 0.5f / (s->hx < s->hy ? s->hx : s->hy);
+        float q = k * 2.f * m + sqrtf(m * m + 1.f);
+        *out_hx = s->hx * q;
+        *out_hy = s->hy * q;
+        *out_r = 0.f;
+    }
+    else
+    {
+        // the offset of a circle is a circle,
+        // and the offset of a rounded rectangle is a rounded rectangle with the radius r + k
+        *out_hx = s->hx + k;
+        *out_hy = s->hy + k;
+        *out_r = s->r + k;
+        if (*out_r < 0.f) *out_r = 0.f;
+    }
+}
+
+/*
+* Half width of the offset shape (see prim_offset_size) on the row whose center is dy from the shape center.
+* Return 0 if the row misses it.
+*/
+static int prim_half_width(PrimShape* s, float dy, int outer, float* out_hw)
+{
+    float hx, hy, r, t;
+    
+    prim_offset_size(s, outer, &hx, &hy, &r);
+    dy = fabsf(dy);
+    if (hx <= 0.f || hy <= 0.f || dy >= hy)
+        return 0;
+    
+    if (s->type == PRIM_ELLIPSE)
+    {
+        t = dy / hy;
+        *out_hw = hx * sqrtf(1.f - t * t);
+    }
+    else if (dy <= hy - r)
+        *out_hw = hx;
+    else
+    {
+        t = dy - (hy - r);
+        *out_hw = hx - r + sqrtf(r * r - t * t);
+    }
+    return 1;
+}
+
+// source-over of the coverage c
+static void prim_blend(uint8_t* dst, int c)
+{
+    int d = *dst;
+    *dst = (uint8_t)(d + c - (d * c + 127) / 255);
+}
+
+static void prim_blend_coverage(uint8_t* dst, float d)
+{
+    float c = 0.5f - d;
+    if (c <= 0.f)
+        return;
+    if (c > 1.f)
+        c = 1.f;
+    prim_blend(dst, (int)(c * 255.f + 0.5f));
+}
+
+// the pixels [x0, x1] of a row, p is the pixel x0. The pixels in [xi0, xi1] are fully covered.
+static void prim_composite_span(PrimShape* s, uint8_t* p, int x0, int x1, int xi0, int xi1, float py)
+{
+    int x = x0;
+    
+    for(; x <= x1 && x < xi0; ++x)
+        prim_blend_coverage(p + (x - x0), prim_distance(s, x + 0.5f, py));
+    
+    if (x <= xi1)
+    {
+        int end = xi1 < x1 ? xi1 : x1;
+        memset(p + (x - x0), 255, end - x + 1); // full coverage over anything is full coverage
+        x = end + 1;
+    }
+    
+    for(; x <= x1; ++x)
+        prim_blend_coverage(p + (x - x0), prim_distance(s, x + 0.5f, py));
+}
+
+static void canvas_rasterize_prim(Canvas* canvas, PrimShape* s)
+{
+    int j, j0, j1;
+    float hw, hh, r;
+    CanvasRect rect;
+    TRACE_DECL(trace_composite);
+    
+    assert(canvas->comp == 1);
+    
+    // the rows of the grown shape
+    prim_offset_size(s, 1, &hw, &hh, &r);
+    TRACE_BEGIN(trace_composite, "composite primitive");
+    j0 = IFLOOR(s->cy - hh);
+    j1 = IFLOOR(s->cy + hh);
+    if (j0 < 0) j0 = 0;
+    if (j1 > canvas->h - 1) j1 = canvas->h - 1;
+    
+    rect.x0 = IFLOOR(s->cx - hw) - 1;
+    rect.y0 = j0;
+    rect.x1 = IFLOOR(s->cx + hw) + 2;
+    rect.y1 = j1 + 1;
+    canvas_mark_dirty(canvas, rect);
+    
+    for(j = j0; j <= j1; ++j)
+    {
+        float py = j + 0.5f;
+        float dy = py - s->cy;
+        int x, xo0, xo1, xi0, xi1;
+        
+        if (!prim_half_width(s, dy, 1, &hw))
+            continue;
+        
+        // pixels whose center is in the outer span
+        xo0 = (int)ceilf(s->cx - hw - 0.5f);
+        xo1 = IFLOOR(s->cx + hw - 0.5f);
+        if (xo0 < 0) xo0 = 0;
+        if (xo1 > canvas->w - 1) xo1 = canvas->w - 1;
+        if (xo0 > xo1)
+            continue;
+        
+        // pixels whose center is in the inner span
+        if (prim_half_width(s, dy, 0, &hw))
+        {
+            xi0 = (int)ceilf(s->cx - hw - 0.5f);
+            xi1 = IFLOOR(s->cx + hw - 0.5f);
+            if (xi0 < xo0) xi0 = xo0;
+            if (xi1 > xo1) xi1 = xo1;
+        }
+        else
+        {
+            xi0 = xo1 + 1;
+            xi1 = xo1;
+        }
+        
+        // per contiguous run of the canvas, the whole outer span on a linear canvas
+        for(x = xo0; x <= xo1;)
+        {
+            int count = canvas_row_span(canvas, x);
+            uint8_t* p = canvas_pixel(canvas, x, j);
+            if (count > xo1 + 1 - x)
+                count = xo1 + 1 - x;
+            if (p)
+                prim_composite_span(s, p, x, x + count - 1, xi0, xi1, py);
+            x += count;
+        }
+    }
+    
+    TRACE_END(trace_composite);
+}
+
+void canvas_rasterize_circle(Canvas* canvas, float cx, float cy, float r)
+{
+    PrimShape s = {PRIM_ELLIPSE, cx, cy, r, r, 0.f};
+    canvas_rasterize_prim(canvas, &s);
+}
+
+void canvas_rasterize_ellipse(Canvas* canvas, float cx, float cy, float rx, float ry)
+{
+    PrimShape s = {PRIM_ELLIPSE, cx, cy, rx, ry, 0.f};
+    canvas_rasterize_prim(canvas, &s);
+}
+
+void canvas_rasterize_round_rect(Canvas* canvas, float x0, float y0, float x1, float y1, float r)
+{
+    PrimShape s;
+    s.type = PRIM_ROUND_RECT;
+    s.cx = (x0 + x1) * 0.5f;
+    s.cy = (y0 + y1) * 0.5f;
+    s.hx = fabsf(x1 - x0) * 0.5f;
+    s.hy = fabsf(y1 - y0) * 0.5f;
+    s.r = r;
+    if (s.r > s.hx) s.r = s.hx;
+    if (s.r > s.hy) s.r = s.hy;
+    if (s.r < 0.f) s.r = 0.f;
+    canvas_rasterize_prim(canvas, &s);
+}
@@ -3,6 +3,7 @@
 #define RAST1_FIXSHIFT 10
 #define RAST1_FIX (1 << RAST1_FIXSHIFT) // (1 << 10) == 1024
 #define RAST1_FIXMASK (RAST1_FIX - 1)
+#define RAST1_TRACE_BAND 64 // rows per "rasterize band" trace event
 
 /*
 * NOTE(chan)
@@ -14,13 +15,18 @@
 * I guess the reason Sean use RAST1_FIX is to avoid using a very small floating-point
 * that could cause an unaccurate operation.
 * To calculate the start x of the active edge, you multiply dx with 'start_point - e->y0'.
+*
+* A sweep that starts below the top (a strip, see rasterize1_sorted_edges_out_of_core) activates
+* the edges that started above it late. Their x is computed at the scanline where a sweep from the top
+* would have activated them, and then stepped by dx, so the rounding is the same as the full sweep.
 */
-static ActiveEdge* rast1_new_active(Heap* h, Edge* e, float start_point)
+static void rast1_init_active(ActiveEdge* z, Edge* e, float start_point)
 {
-    ActiveEdge* z = (ActiveEdge*)heap_alloc(h, sizeof(*z));
     float dxdy = (e->x1 - e->x0) / (e->y1 - e->y0);
-    assert(z != NULL);
-    if (!z) return z;
+    float first_point = (float)ceil(e->y0 - 0.5f) + 0.5f; // the first scanline center at or below y0
+    
+    if (first_point < 0.5f)
+        first_point = 0.5f;
     
     // NOTE(sean) : round dx down to avoid overshooting
     if(dxdy < 0)
@@ -28,14 +34,150 @@ static ActiveEdge* rast1_new_active(Heap* h, Edge* e, float start_point)
     else
         z->dx = IFLOOR(RAST1_FIX * dxdy);
     
-    z->x = IFLOOR(RAST1_FIX * e->x0 + z->dx * (start_point - e->y0));
+    if (start_point > first_point)
+        z->x = IFLOOR(RAST1_FIX * e->x0 + z->dx * (first_point - e->y0)) + z->dx * (int)(start_point - first_point);
+    else
+        z->x = IFLOOR(RAST1_FIX * e->x0 + z->dx * (start_point - e->y0));
     
     z->ey = e->y1;
     z->next = 0;
     z->direction = e->invert ? 1.f : -1.f;
+    z->shape = e->shape;
+}
+
+static ActiveEdge* rast1_new_active(Heap* h, Edge* e, float start_point)
+{
+    ActiveEdge* z = (ActiveEdge*)heap_alloc(h, sizeof(*z));
+    assert(z != NULL);
+    if (!z) return z;
+    
+    rast1_init_active(z, e, start_point);
     return z;
 }
 
+/*
+* Fill the pixels between x0 and x1 (fixed point) with the antialiased coverage at both ends.
+*/
+static void rast1_fill_span(unsigned char* scanline, int len, int x0, int x1, int max_weight)
+{
+    int i = x0 >> RAST1_FIXSHIFT;
+    int j = x1 >> RAST1_FIXSHIFT;
+    
+    if (i < len && j >= 0)
+    {
+        if (i == j)
+        {
+            // x0, x1 are the same pixel, so compute comibned coverage
+            scanline[i] = scanline[i] + (uint8_t)(((x1 - x0) * max_weight) >> RAST1_FIXSHIFT);
+            STATS_ADD(pixels_touched, 1);
+        }
+        else
+        {
+            if (i >= 0) // add antialiasing for x0
+                scanline[i] = scanline[i] + (uint8_t)(((RAST1_FIX - (x0 & RAST1_FIXMASK)) * max_weight) >> RAST1_FIXSHIFT);
+            else
+                i = -1; // clip
+            
+            if (j < len) // add antialiasing for x1
+                scanline[j] = scanline[j] + (uint8_t)(((x1 & RAST1_FIXMASK) * max_weight) >> RAST1_FIXSHIFT);
+            else
+                j = len; // clip
+            
+            STATS_ADD(pixels_touched, j - (i < 0 ? 0 : i) + (j < len));
+            for(++i; i < j; ++i) // fill pixels between x0 and x1
+                scanline[i] = scanline[i] + (uint8_t)max_weight;
+        }
+    }
+}
+
+/*
+* NOTE(chan) : Occlusion. opaque is a span list, the sorted and disjoint pixel intervals [opaque[2k], opaque[2k + 1])
+* that the fill skips. In a scene they are covered completely by a shape in front, which overwrites them,
+* and with a clip mask they are outside the clip.
+* rast1_opaque_find returns the first interval that ends after x.
+*/
+static int rast1_opaque_find(const int* opaque, int opaque_count, int x)
+{
+    int lo = 0, hi = opaque_count;
+    while(lo < hi)
+    {
+        int mid = (lo + hi) >> 1;
+        if (opaque[2 * mid + 1] <= x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// rast1_fill_span without the pixels in the opaque span list
+static void rast1_fill_span_occluded(unsigned char* scanline, int len, int x0, int x1, int max_weight, const int* opaque, int opaque_count)
+{
+    int i = x0 >> RAST1_FIXSHIFT;
+    int j = x1 >> RAST1_FIXSHIFT;
+    int k;
+    
+    if (opaque_count == 0)
+    {
+        rast1_fill_span(scanline, len, x0, x1, max_weight);
+        return;
+    }
+    if (i >= len || j < 0)
+        return;
+    
+    k = rast1_opaque_find(opaque, opaque_count, i < 0 ? 0 : i);
+    if (k < opaque_count && opaque[2 * k] <= (i < 0 ? 0 : i) && (j < len ? j : len - 1) < opaque[2 * k + 1])
+    {
+        // hidden as a whole, the common case deep in a scene
+        STATS_ADD(pixels_occluded, (j < len ? j : len - 1) - (i < 0 ? 0 : i) + 1);
+        return;
+    }
+    
+    if (i == j)
+    {
+        scanline[i] = scanline[i] + (uint8_t)(((x1 - x0) * max_weight) >> RAST1_FIXSHIFT);
+        STATS_ADD(pixels_touched, 1);
+        return;
+    }
+    
+    if (i >= 0)
+    {
+        int t = rast1_opaque_find(opaque, opaque_count, i);
+        if (t == opaque_count || opaque[2 * t] > i)
+            scanline[i] = scanline[i] + (uint8_t)(((RAST1_FIX - (x0 & RAST1_FIXMASK)) * max_weight) >> RAST1_FIXSHIFT);
+    }
+    else
+        i = -1;
+    
+    if (j < len)
+    {
+        int t = rast1_opaque_find(opaque, opaque_count, j);
+        if (t == opaque_count || opaque[2 * t] > j)
+            scanline[j] = scanline[j] + (uint8_t)(((x1 & RAST1_FIXMASK) * max_weight) >> RAST1_FIXSHIFT);
+    }
+    else
+        j = len;
+    
+    // the pixels between the ends, in the gaps of the span list
+    for(int x = i + 1; x < j;)
+    {
+        int end;
+        while(k < opaque_count && opaque[2 * k + 1] <= x)
+            ++k;
+        if (k < opaque_count && opaque[2 * k] <= x)
+        {
+            end = opaque[2 * k + 1] < j ? opaque[2 * k + 1] : j;
+            STATS_ADD(pixels_occluded, end - x);
+            x = end;
+            continue;
+        }
+        end = (k < opaque_count && opaque[2 * k] < j) ? opaque[2 * k] : j;
+        STATS_ADD(pixels_touched, end - x);
+        for(; x < end; ++x)
+            scanline[x] = scanline[x] + (uint8_t)max_weight;
+    }
+}
+
 /*
 * NOTE(chan): !!core function!!
 * 
@@ -58,11 +200,22 @@ static ActiveEdge* rast1_new_active(Heap* h, Edge* e, float start_point)
 *
 * TODO(chan) : study more about combined coverage and anti aliasing.
 */
-static void rast1_fill_active(unsigned char* scanline, int len, ActiveEdge* e, int max_weight)
+static void rast1_fill_active_occluded(unsigned char* scanline, int len, ActiveEdge* e, int max_weight, FillRule rule, const int* opaque, int opaque_count)
 {
-    // non-zero winding fill
     int x0 = 0, w = 0;
     
+    if (rule == FILL_EVEN_ODD)
+    {
+        // the list is sorted by x, so the inside spans are between the 1st and 2nd, the 3rd and 4th edge...
+        while(e && e->next)
+        {
+            rast1_fill_span_occluded(scanline, len, e->x, e->next->x, max_weight, opaque, opaque_count);
+            e = e->next->next;
+        }
+        return;
+    }
+    
+    // non-zero winding fill
     while(e)
     {
         if (w == 0)
@@ -76,166 +229,845 @@ static void rast1_fill_active(unsigned char* scanline, int len, ActiveEdge* e, i
             
             // if we went to zero, we need to draw
             if (w == 0)
+                rast1_fill_span_occluded(scanline, len, x0, x1, max_weight, opaque, opaque_count);
+        }
+        
+        e = e->next;
+    }
+}
+
+static void rast1_fill_active(unsigned char* scanline, int len, ActiveEdge* e, int max_weight, FillRule rule)
+{
+    rast1_fill_active_occluded(scanline, len, e, max_weight, rule, NULL, 0);
+}
+
+/*
+* NOTE(chan) : Algorithm 3-2, 3-5, 3-3 and 3-1 for the scanline at scan_y.
+* This updates the active edge list so that it can be filled with rast1_fill_active.
+* The sweep state lives in the caller (the heap, the active list and the edge cursor),
+* so every rasterizer that walks the sorted edges can share this step.
+*/
+static void rast1_update_active(Heap* hh, ActiveEdge** active, Edge** edge_cursor, Edge* sentinel, float scan_y)
+{
+    ActiveEdge** step = active;
+    Edge* e = *edge_cursor;
+#ifdef SCANLINE_STATS
+    int active_count = 0;
+#endif
+    
+    // NOTE(sean) : update all active edges;
+    // remove all active edges that terminate before the center of this scanline
+    // NOTE(chan) : Algorithm 3-2 for `if (z->ey <= scan_y)`
+    //              Algorithm 3-5 for 'else'
+    while(*step)
+    {
+        ActiveEdge* z = *step;
+        // NOTE(chan) : remember z->ey is the y1 of Edge, where
+        // y1 is always bigger that y0.
+        // so if (z->ey <= scan_y) is true, then we don't need to care this edge any more.
+        if (z->ey <= scan_y)
+        {
+            *step = z->next; // delete from list
+            assert(z->direction != 0.f);
+            z->direction = 0;
+            heap_free(hh, z);
+        }
+        else
+        {
+            z->x += z->dx; // advance to position for current scanline
+            step = &((*step)->next);
+#ifdef SCANLINE_STATS
+            ++active_count;
+#endif
+        }
+    }
+    
+    // NOTE(sean) : resort the list if needed
+    // NOTE(chan) : Algorithm 3-3
+    for(;;)
+    {
+        int changed = 0;
+        step = active;
+        while (*step && (*step)->next)
+        {
+            if((*step)->x > (*step)->next->x)
             {
-                int i = x0 >> RAST1_FIXSHIFT;
-                int j = x1 >> RAST1_FIXSHIFT;
+                ActiveEdge* t = *step;
+                ActiveEdge* q = t->next;
                 
-                if (i < len && j >= 0)
+                t->next = q->next;
+                q->next = t;
+                *step = q;
+                changed = 1;
+                STATS_ADD(active_swaps, 1);
+            }
+            step = &(*step)->next;
+        }
+        if (!changed) break;
+    }
+    
+    // Algorithm 3-1
+    // NOTE(sean) : insert all edges that start before the center of this scanline
+    // omit ones that also end on this scanline
+    // NOTE(chan) : it was `while (e->y0 <= scan_y)`,
+    // but if the vsubsample is high enough, then 
+    // the while condition is met and it will insert unallocated edges.
+    // So I check the sentinel directly here.
+    // Accordingto the algorithm 3-1, the ActiveEdge.x is the intersection with the scanline.
+    while(e != sentinel && e->y0 <= scan_y) 
+        // while (e->y0 <= scan_y)
+    {
+        if(e->y1 > scan_y)
+        {
+            ActiveEdge* z = rast1_new_active(hh, e, scan_y);
+            if(z != NULL)
+            {
+                // find insertion point
+                if (*active == NULL)
+                    *active = z;
+                else if(z->x < (*active)->x)
+                {
+                    // insert at front
+                    z->next = *active;
+                    *active = z;
+                }
+                else
                 {
-                    if (i == j)
-                    {
-                        // x0, x1 are the same pixel, so compute comibned coverage
-                        scanline[i] = scanline[i] + (uint8_t)(((x1 - x0) * max_weight) >> RAST1_FIXSHIFT);
-                    }
-                    else
-                    {
-                        if (i >= 0) // add antialiasing for x0
-                            scanline[i] = scanline[i] + (uint8_t)(((RAST1_FIX - (x0 & RAST1_FIXMASK)) * max_weight) >> RAST1_FIXSHIFT);
-                        else
-                            i = -1; // clip
-                        
-                        if (j < len) // add antialiasing for x1
-                            scanline[j] = scanline[j] + (uint8_t)(((x1 & RAST1_FIXMASK) * max_weight) >> RAST1_FIXSHIFT);
-                        else
-                            j = len; // clip
-                        
-                        for(++i; i < j; ++i) // fill pixels between x0 and x1
-                            scanline[i] = scanline[i] + (uint8_t)max_weight;
-                    }
+                    // find thing to insert AFTER
+                    ActiveEdge* p = *active;
+                    while(p->next && p->next->x < z->x)
+                        p = p->next;
+                    // at this point, p->next->x is NOT < z->x
+                    z->next = p->next;
+                    p->next = z;
                 }
+#ifdef SCANLINE_STATS
+                ++active_count;
+#endif
             }
         }
+        ++e;
+    }
+    
+    *edge_cursor = e;
+    
+#ifdef SCANLINE_STATS
+    STATS_ADD(scanlines, 1);
+    STATS_ADD(active_edges_sum, active_count);
+    STATS_MAX(active_edges_max, active_count);
+#endif
+}
+
+/*
+* NOTE(chan) : One canvas row of the sweep, the vsubsample scanlines from *y.
+* The sweep state is in the caller, so rast1_sweep_rows and the resumable Rasterizer1 share it.
+*/
+static void rast1_scan_row(Heap* hh, ActiveEdge** active, Edge** edge_cursor, Edge* sentinel, int* y,
+                           uint8_t* scanline, int w, int vsubsample, int max_weight, FillRule rule)
+{
+    int s; // vertical subsample index
+#ifdef SCANLINE_STATS
+    int filled = 0;
+#endif
+    
+    memset(scanline, 0, w);
+    // NOTE(chan) : as long as you use higher vsubsample, 
+    // there would be more active edgese in the current scanline,
+    // and it will be likely to fill more pixels.
+    for(s = 0; s < vsubsample; ++s) 
+    {
+        float scan_y = *y + 0.5f; // we check the center height of the pixel
+        
+        rast1_update_active(hh, active, edge_cursor, sentinel, scan_y);
+        
+        // NOTE(chan) : Algorithm 3-4
+        if (*active)
+        {
+            rast1_fill_active(scanline, w, *active, max_weight, rule);
+#ifdef SCANLINE_STATS
+            filled = 1;
+#endif
+        }
         
-        e = e->next;
+        ++*y;
     }
+    
+#ifdef SCANLINE_STATS
+    STATS_ADD(rows_processed, filled);
+    STATS_ADD(rows_skipped, !filled);
+#endif
 }
 
-void canvas_rasterize1_sorted_edges(Canvas* canvas, Edge* e, int edge_count, int vsubsample)
+/*
+* NOTE(chan) : Per thread scratch of the sweep, the Heap of the active edges and the scanline.
+* The sweep used to make them on every call and free them at the end. Now a thread keeps them,
+* so a worker that renders many shapes (JobPool, the batch renderer) stops allocating after the first ones.
+* The active edges left at the end of a sweep go back to the free list of the heap.
+* A sweep must not start another sweep on the same thread from its RowSinkProc.
+* rasterize1_scratch_free releases the scratch of the calling thread, for example before the thread exits.
+*/
+typedef struct Rast1Scratch
 {
-    Heap hh = {0, 0, 0};
-    int stride = canvas->w * canvas->comp;
-    int j = 0;
-    int y = 0 * vsubsample; // NOTE(chan) : the original code use offset for glyph, but I'm not using glyph here. So I use it as zero.
+    Heap heap;
+    uint8_t* row;
+    int row_capacity;
+} Rast1Scratch;
+
+static SCANLINE_THREAD_LOCAL Rast1Scratch g_rast1_scratch;
+
+static uint8_t* rast1_scratch_row(Rast1Scratch* scratch, int w)
+{
+    if (w > scratch->row_capacity)
+    {
+        SCANLINE_FREE(scratch->row);
+        scratch->row = (uint8_t*)SCANLINE_MALLOC(w);
+        scratch->row_capacity = w;
+    }
+    return scratch->row;
+}
+
+static void rast1_release_active(Heap* hh, ActiveEdge* active)
+{
+    while(active)
+    {
+        ActiveEdge* next = active->next;
+        heap_free(hh, active);
+        active = next;
+    }
+}
+
+void rasterize1_scratch_free(void)
+{
+    Rast1Scratch* scratch = &g_rast1_scratch;
+    heap_cleanup(&scratch->heap);
+    SCANLINE_FREE(scratch->row);
+    memset(scratch, 0, sizeof(*scratch));
+}
+
+static void thread_release_locals(void)
+{
+    rasterize1_scratch_free();
+}
+
+/*
+* NOTE(chan) : The sweep of canvas_rasterize1_sorted_edges over the rows [y_begin, y_end) of a target w pixels wide.
+* Every finished row goes to sink in y order, and the row buffer is reused after sink returns.
+* If sink returns 0, the sweep stops there and returns 0. It returns 1 when all the rows are done.
+* So the target can be a canvas, or an output stream that never holds the whole image.
+* The sweep can start at any row, because an edge that starts above y_begin gets its x
+* at the first scanline when it is activated (rast1_init_active).
+*/
+static int rast1_sweep_rows(int w, int y_begin, int y_end, Edge* e, int edge_count, int vsubsample, FillRule rule, RowSinkProc sink, void* user)
+{
+    Heap* hh = &g_rast1_scratch.heap;
+    int j = y_begin;
+    int y = y_begin * vsubsample; // NOTE(chan) : the original code use offset for glyph. Here it is the first row of the sweep.
     int max_weight = (255 / vsubsample); 
-    int s; // vertical subsample index
     ActiveEdge* active = NULL;
     
     // this edge array has one more element for sentinel
     // refer to edges_alloc_for_raster_from_polygon(~).
     Edge* sentinel = e + edge_count;
     // e[edge_count].y0 = canvas->h * vsubsample;
-    uint8_t* scanline =  (uint8_t*)malloc(canvas->w);
+    uint8_t* scanline = rast1_scratch_row(&g_rast1_scratch, w);
+    TRACE_DECL(trace_band);
     
-    while(j < canvas->h)
+    while(j < y_end)
     {
-        memset(scanline, 0, canvas->w);
-        // NOTE(chan) : as long as you use higher vsubsample, 
-        // there would be more active edgese in the current scanline,
-        // and it will be likely to fill more pixels.
-        for(s = 0; s < vsubsample; ++s) 
+        if ((j - y_begin) % RAST1_TRACE_BAND == 0)
+            TRACE_BEGIN_ARG(trace_band, "rasterize band", j);
+        
+        rast1_scan_row(hh, &active, &e, sentinel, &y, scanline, w, vsubsample, max_weight, rule);
+        if (!sink(user, j, scanline))
+        {
+            TRACE_END(trace_band);
+            break;
+        }
+        ++j;
+        
+        if ((j - y_begin) % RAST1_TRACE_BAND == 0 || j == y_end)
+            TRACE_END(trace_band);
+    }
+    
+    rast1_release_active(hh, active);
+    return j == y_end;
+}
+
+int rasterize1_sorted_edges_to_sink(int w, int h, Edge* e, int edge_count, int vsubsample, FillRule rule, RowSinkProc sink, void* user)
+{
+    return rast1_sweep_rows(w, 0, h, e, edge_count, vsubsample, rule, sink, user);
+}
+
+static int rast1_canvas_sink(void* user, int y, const uint8_t* row)
+{
+    Canvas* canvas = (Canvas*)user;
+    canvas_write_row(canvas, y, row, canvas->w);
+    return 1;
+}
+
+void canvas_rasterize1_sorted_edges(Canvas* canvas, Edge* e, int edge_count, int vsubsample)
+{
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    rast1_sweep_rows(canvas->w, 0, canvas->h, e, edge_count, vsubsample, FILL_NONZERO, rast1_canvas_sink, canvas);
+}
+
+// canvas_rasterize1_sorted_edges with the even-odd rule or the non-zero rule
+void canvas_rasterize1_sorted_edges_fill_rule(Canvas* canvas, Edge* e, int edge_count, int vsubsample, FillRule rule)
+{
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    rast1_sweep_rows(canvas->w, 0, canvas->h, e, edge_count, vsubsample, rule, rast1_canvas_sink, canvas);
+}
+
+/*
+* NOTE(chan) : Time sliced rasterization.
+*     Rasterizer1 r;
+*     rasterizer1_begin(&r, canvas, edges, edge_count, vsubsample, FILL_NONZERO);
+*     while(!rasterizer1_step(&r, 64)) // 64 rows per frame
+*         ...handle the events...
+*     rasterizer1_end(&r);
+* The edges must stay alive until rasterizer1_end. The canvas is the same as canvas_rasterize1_sorted_edges_fill_rule,
+* whatever the slices are, and the rows below r.j are final after every step.
+* rasterizer1_begin returns 0 if the scanline can't be allocated, then rasterizer1_step returns 1 without a row.
+*/
+int rasterizer1_begin(Rasterizer1* r, Canvas* canvas, Edge* e, int edge_count, int vsubsample, FillRule rule)
+{
+    memset(r, 0, sizeof(*r));
+    r->canvas = canvas;
+    r->edge_cursor = e;
+    r->sentinel = e + edge_count;
+    r->vsubsample = vsubsample;
+    r->max_weight = 255 / vsubsample;
+    r->rule = rule;
+    r->scanline = (uint8_t*)SCANLINE_MALLOC(canvas->w);
+    return r->scanline != NULL;
+}
+
+// rasterize up to max_rows more rows, returns 1 when the canvas is done
+int rasterizer1_step(Rasterizer1* r, int max_rows)
+{
+    Canvas* canvas = r->canvas;
+    int end = canvas->h - r->j < max_rows ? canvas->h : r->j + max_rows;
+    TRACE_DECL(trace_step);
+    
+    if (r->scanline == NULL)
+        return 1;
+    if (r->j >= end)
+        return r->j == canvas->h;
+    
+    canvas_mark_dirty_rows(canvas, r->j, end);
+    TRACE_BEGIN_ARG(trace_step, "rasterize step", r->j);
+    for(; r->j < end; ++r->j)
+    {
+        rast1_scan_row(&r->heap, &r->active, &r->edge_cursor, r->sentinel, &r->y, r->scanline, canvas->w, r->vsubsample, r->max_weight, r->rule);
+        canvas_write_row(canvas, r->j, r->scanline, canvas->w);
+    }
+    TRACE_END(trace_step);
+    
+    return r->j == canvas->h;
+}
+
+// frees the state, the canvas keeps the rows done so far
+void rasterizer1_end(Rasterizer1* r)
+{
+    heap_cleanup(&r->heap);
+    SCANLINE_FREE(r->scanline);
+    memset(r, 0, sizeof(*r));
+}
+
+/*
+* NOTE(chan) : Progressive rendering, a coarse preview first and then the full quality rows.
+* The preview rasterizes at 1/factor of the resolution with vsubsample 1, which is about
+* 1 / (factor * factor * vsubsample) of the work, and replicates every coarse pixel over factor x factor pixels.
+* The coarse edges are the sorted edges scaled by 1/factor in x and 1/(factor * vsubsample) in y.
+* The scale is positive, so they keep the order of the sorted array and aren't sorted again.
+*     Rasterizer1 r;
+*     rasterizer1_begin_progressive(&r, canvas, edges, edge_count, vsubsample, FILL_NONZERO, 8);
+*     ...show the canvas...
+*     while(!rasterizer1_step(&r, 64)) // refine, the rows below r.j are final
+*         ...show the canvas...
+*     rasterizer1_end(&r);
+*/
+void canvas_rasterize1_preview(Canvas* canvas, Edge* e, int edge_count, int vsubsample, FillRule rule, int factor)
+{
+    int cw, ch;
+    float sx, sy;
+    Edge* coarse;
+    Canvas* small;
+    uint8_t* line;
+    TRACE_DECL(trace_preview);
+    
+    if (factor < 1)
+        factor = 1;
+    cw = (canvas->w + factor - 1) / factor;
+    ch = (canvas->h + factor - 1) / factor;
+    sx = 1.f / factor;
+    sy = 1.f / ((float)factor * vsubsample);
+    
+    small = canvas_create(cw, ch);
+    coarse = (Edge*)SCANLINE_MALLOC(sizeof(Edge) * (edge_count + 1)); // + 1 for the sentinel
+    line = (uint8_t*)SCANLINE_MALLOC(canvas->w);
+    if (small == NULL || coarse == NULL || line == NULL)
+    {
+        // no preview, the canvas is left as it is
+        SCANLINE_FREE(line);
+        SCANLINE_FREE(coarse);
+        if (small)
+            canvas_destroy(small);
+        return;
+    }
+    
+    TRACE_BEGIN(trace_preview, "rasterize preview");
+    
+    for(int i = 0; i < edge_count; ++i)
+    {
+        coarse[i] = e[i];
+        coarse[i].x0 *= sx;
+        coarse[i].y0 *= sy;
+        coarse[i].x1 *= sx;
+        coarse[i].y1 *= sy;
+    }
+    coarse[edge_count].y0 = (float)ch;
+    
+    rast1_sweep_rows(cw, 0, ch, coarse, edge_count, 1, rule, rast1_canvas_sink, small);
+    
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    // nearest upsampling, a coarse row is expanded once and copied to the next factor - 1 rows
+    for(int y = 0; y < canvas->h; ++y)
+    {
+        if (y % factor == 0)
+        {
+            const uint8_t* src = small->p + (size_t)(y / factor) * cw;
+            for(int x = 0; x < canvas->w; ++x)
+                line[x] = src[x / factor];
+        }
+        canvas_write_row(canvas, y, line, canvas->w);
+    }
+    
+    TRACE_END(trace_preview);
+    
+    SCANLINE_FREE(line);
+    SCANLINE_FREE(coarse);
+    canvas_destroy(small);
+}
+
+// rasterizer1_begin after a canvas_rasterize1_preview of the same edges
+int rasterizer1_begin_progressive(Rasterizer1* r, Canvas* canvas, Edge* e, int edge_count, int vsubsample, FillRule rule, int factor)
+{
+    canvas_rasterize1_preview(canvas, e, edge_count, vsubsample, rule, factor);
+    return rasterizer1_begin(r, canvas, e, edge_count, vsubsample, rule);
+}
+
+/*
+* NOTE(chan) : Rasterize straight into a PNG file without a canvas.
+* The PNG stream encodes the rows on its own thread while the next rows are rasterized,
+* and the memory is a few rows instead of w x h.
+*/
+int rasterize1_sorted_edges_to_png(const char* file_name, int w, int h, Edge* e, int edge_count, int vsubsample, PngOptions* options)
+{
+    PngStream* stream = png_stream_open(file_name, w, h, 1, options);
+    if (stream == NULL)
+    {
+        printf("Fail to save a canvas on %s\n", file_name);
+        return 0;
+    }
+    
+    rasterize1_sorted_edges_to_sink(w, h, e, edge_count, vsubsample, FILL_NONZERO, png_stream_row_sink, stream);
+    
+    if (!png_stream_close(stream))
+    {
+        printf("Fail to save a canvas on %s\n", file_name);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+* NOTE(chan) : Out-of-core rendering, for canvases that don't fit in the memory.
+* The image is rasterized in horizontal strips of strip_rows rows into band canvases,
+* and the strips are written to a PNG stream in order. So the memory is thread_count bands
+* and the edges, whatever the canvas size is.
+* The edges of a strip are the edges of the previous strip that are still alive (carried over),
+* followed by the edges that start in this strip. The carried edges start above the strip
+* and the new ones don't, so the subset is also sorted by y0 and the sweep can run on it.
+* The sorted edge list is walked once. The strips of a group of thread_count strips
+* are rasterized on parallel_for, and then the group is written.
+* The coverage is the same as canvas_rasterize1_sorted_edges, except that edges crossing at the same x
+* on the first row of a strip can be ordered differently, which moves a pixel by one coverage level.
+*/
+#define RAST1_STRIP_BYTES (16 * 1024 * 1024) // default band size
+
+typedef struct Rast1Strip
+{
+    Canvas* band;
+    int y0, rows;
+    Edge* edges;
+    int edge_count, edge_capacity;
+} Rast1Strip;
+
+typedef struct Rast1OutOfCore
+{
+    Rast1Strip* strips;
+    int vsubsample;
+} Rast1OutOfCore;
+
+static int rast1_band_sink(void* user, int y, const uint8_t* row)
+{
+    Rast1Strip* strip = (Rast1Strip*)user;
+    memcpy(strip->band->p + (size_t)(y - strip->y0) * strip->band->w, row, strip->band->w);
+    return 1;
+}
+
+static void rast1_rasterize_strip(void* user, int index)
+{
+    Rast1OutOfCore* ooc = (Rast1OutOfCore*)user;
+    Rast1Strip* strip = ooc->strips + index;
+    rast1_sweep_rows(strip->band->w, strip->y0, strip->y0 + strip->rows, strip->edges, strip->edge_count, ooc->vsubsample, FILL_NONZERO, rast1_band_sink, strip);
+}
+
+static void rast1_strip_push_edge(Rast1Strip* strip, const Edge* e)
+{
+    if (strip->edge_count + 1 >= strip->edge_capacity) // + 1 for the sentinel
+    {
+        strip->edge_capacity = strip->edge_capacity ? strip->edge_capacity * 2 : 64;
+        strip->edges = (Edge*)SCANLINE_REALLOC(strip->edges, sizeof(Edge) * strip->edge_capacity);
+    }
+    strip->edges[strip->edge_count++] = *e;
+}
+
+/*
+* strip_rows <= 0 picks bands of about RAST1_STRIP_BYTES, thread_count <= 0 uses all the hardware threads.
+* Returns 0 if the file can't be written or a band can't be allocated.
+*/
+int rasterize1_sorted_edges_out_of_core(const char* file_name, int w, int h, Edge* e, int edge_count, int vsubsample, int strip_rows, int thread_count, PngOptions* options)
+{
+    Rast1OutOfCore ooc;
+    PngStream* stream;
+    Edge* cursor = e;
+    Edge* sentinel = e + edge_count;
+    Edge* carry = NULL; // the alive edges of the last built strip
+    int carry_count = 0;
+    int y = 0;
+    int ok = 1;
+    
+    if (thread_count <= 0)
+        thread_count = thread_hardware_count();
+    if (strip_rows <= 0)
+        strip_rows = RAST1_STRIP_BYTES / w > 0 ? RAST1_STRIP_BYTES / w : 1;
+    if (strip_rows > h)
+        strip_rows = h > 0 ? h : 1;
+    
+    stream = png_stream_open(file_name, w, h, 1, options);
+    if (stream == NULL)
+    {
+        printf("Fail to save a canvas on %s\n", file_name);
+        return 0;
+    }
+    
+    ooc.vsubsample = vsubsample;
+    ooc.strips = (Rast1Strip*)SCANLINE_MALLOC(sizeof(Rast1Strip) * thread_count);
+    memset(ooc.strips, 0, sizeof(Rast1Strip) * thread_count);
+    
+    while(ok && y < h)
+    {
+        int group = 0;
+        
+        // build the edge subsets of the next group of strips
+        for(; group < thread_count && y < h; ++group)
         {
-            float scan_y = y + 0.5f; // we check the center height of the pixel
-            ActiveEdge** step = &active;
+            Rast1Strip* strip = ooc.strips + group;
+            float y_top = (float)y * vsubsample;
+            float y_bottom;
             
-            // NOTE(sean) : update all active edges;
-            // remove all active edges that terminate before the center of this scanline
-            // NOTE(chan) : Algorithm 3-2 for `if (z->ey <= scan_y)`
-            //              Algorithm 3-5 for 'else'
-            while(*step)
+            strip->y0 = y;
+            strip->rows = (h - y) < strip_rows ? (h - y) : strip_rows;
+            strip->edge_count = 0;
+            y_bottom = (float)(y + strip->rows) * vsubsample;
+            if (strip->band == NULL)
+                strip->band = canvas_create(w, strip_rows);
+            if (strip->band == NULL)
             {
-                ActiveEdge* z = *step;
-                // NOTE(chan) : remember z->ey is the y1 of Edge, where
-                // y1 is always bigger that y0.
-                // so if (z->ey <= scan_y) is true, then we don't need to care this edge any more.
-                if (z->ey <= scan_y)
-                {
-                    *step = z->next; // delete from list
-                    assert(z->direction != 0.f);
-                    z->direction = 0;
-                    heap_free(&hh, z);
-                }
-                else
-                {
-                    z->x += z->dx; // advance to position for current scanline
-                    step = &((*step)->next);
-                }
+                ok = 0;
+                break;
             }
             
-            // NOTE(sean) : resort the list if needed
-            // NOTE(chan) : Algorithm 3-3
-            for(;;)
+            for(int i = 0; i < carry_count; ++i)
             {
-                int changed = 0;
-                step = &active;
-                while (*step && (*step)->next)
-                {
-                    if((*step)->x > (*step)->next->x)
-                    {
-                        ActiveEdge* t = *step;
-                        ActiveEdge* q = t->next;
-                        
-                        t->next = q->next;
-                        q->next = t;
-                        *step = q;
-                        changed = 1;
-                    }
-                    step = &(*step)->next;
-                }
-                if (!changed) break;
+                if (carry[i].y1 > y_top)
+                    rast1_strip_push_edge(strip, carry + i);
+            }
+            while(cursor != sentinel && cursor->y0 < y_bottom)
+            {
+                if (cursor->y1 > y_top)
+                    rast1_strip_push_edge(strip, cursor);
+                ++cursor;
+            }
+            
+            carry = strip->edges;
+            carry_count = strip->edge_count;
+            y += strip->rows;
+        }
+        if (!ok)
+            break;
+        
+        parallel_for(group, thread_count, rast1_rasterize_strip, &ooc);
+        
+        for(int i = 0; i < group; ++i)
+        {
+            Rast1Strip* strip = ooc.strips + i;
+            for(int r = 0; r < strip->rows; ++r)
+                png_stream_write_row(stream, strip->band->p + (size_t)r * w);
+        }
+        
+        // the next group is built from the edges of the last strip, so move them to the first slot.
+        // Then the first strip filters its own array in place, which never grows while it is read.
+        if (group > 1)
+        {
+            Rast1Strip t = ooc.strips[0];
+            ooc.strips[0] = ooc.strips[group - 1];
+            ooc.strips[group - 1] = t;
+            carry = ooc.strips[0].edges;
+        }
+    }
+    
+    // a band that can't be allocated stops the file there, and it is closed as it is
+    if (!png_stream_close(stream))
+        ok = 0;
+    if (!ok)
+        printf("Fail to save a canvas on %s\n", file_name);
+    
+    for(int i = 0; i < thread_count; ++i)
+    {
+        if (ooc.strips[i].band)
+            canvas_destroy(ooc.strips[i].band);
+        SCANLINE_FREE(ooc.strips[i].edges);
+    }
+    SCANLINE_FREE(ooc.strips);
+    return ok;
+}
+
+/*
+* NOTE(chan) : Fast path for EDGE_SHAPE_CONVEX.
+* Every scanline of a convex polygon crosses zero or two edges, a left one and a right one.
+* So we keep just two active edges on the stack instead of the list.
+* There is nothing to sort except swapping the two, and no winding to count,
+* because the two edges always have opposite directions.
+* The active edges step exactly like canvas_rasterize1_sorted_edges,
+* so the coverage values are the same.
+*/
+void canvas_rasterize1_sorted_edges_convex(Canvas* canvas, Edge* e, int edge_count, int vsubsample)
+{
+    size_t stride = (size_t)canvas->w * canvas->comp;
+    int j = 0;
+    int y = 0;
+    int max_weight = (255 / vsubsample);
+    int s, k;
+    ActiveEdge slots[2];
+    int used[2] = {0, 0};
+    Edge* sentinel = e + edge_count;
+    TRACE_DECL(trace_band);
+    
+    // the canvas rows are the scanlines here, so a tiled canvas takes the general sweep
+    if (canvas->tiles)
+    {
+        canvas_rasterize1_sorted_edges(canvas, e, edge_count, vsubsample);
+        return;
+    }
+    
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    while(j < canvas->h)
+    {
+        // the canvas row is the scanline, so there is no copy at the end.
+        uint8_t* scanline = canvas->p + (size_t)j * stride;
+#ifdef SCANLINE_STATS
+        int filled = 0;
+#endif
+        if (j % RAST1_TRACE_BAND == 0)
+            TRACE_BEGIN_ARG(trace_band, "rasterize band", j);
+        
+        memset(scanline, 0, canvas->w);
+        
+        for(s = 0; s < vsubsample; ++s)
+        {
+            float scan_y = y + 0.5f;
+            
+            // Algorithm 3-2, 3-5
+            for(k = 0; k < 2; ++k)
+            {
+                if (!used[k])
+                    continue;
+                if (slots[k].ey <= scan_y)
+                    used[k] = 0;
+                else
+                    slots[k].x += slots[k].dx;
             }
             
             // Algorithm 3-1
-            // NOTE(sean) : insert all edges that start before the center of this scanline
-            // omit ones that also end on this scanline
-            // NOTE(chan) : it was `while (e->y0 <= scan_y)`,
-            // but if the vsubsample is high enough, then 
-            // the while condition is met and it will insert unallocated edges.
-            // So I check the sentinel directly here.
-            // Accordingto the algorithm 3-1, the ActiveEdge.x is the intersection with the scanline.
-            while(e != sentinel && e->y0 <= scan_y) 
-                // while (e->y0 <= scan_y)
+            while(e != sentinel && e->y0 <= scan_y)
             {
                 if(e->y1 > scan_y)
                 {
-                    ActiveEdge* z = rast1_new_active(&hh, e, scan_y);
-                    if(z != NULL)
-                    {
-                        // find insertion point
-                        if (active == NULL)
-                            active = z;
-                        else if(z->x < active->x)
-                        {
-                            // insert at front
-                            z->next = active;
-                            active = z;
-                        }
-                        else
-                        {
-                            // find thing to insert AFTER
-                            ActiveEdge* p = active;
-                            while(p->next && p->next->x < z->x)
-                                p = p->next;
-                            // at this point, p->next->x is NOT < z->x
-                            z->next = p->next;
-                            p->next = z;
-                        }
-                    }
+                    k = used[0] ? 1 : 0;
+                    assert(!used[k]); // not convex
+                    rast1_init_active(slots + k, e, scan_y);
+                    used[k] = 1;
                 }
                 ++e;
             }
             
-            // NOTE(chan) : Algorithm 3-4
-            if (active)
-                rast1_fill_active(scanline, canvas->w, active, max_weight);
+#ifdef SCANLINE_STATS
+            STATS_ADD(scanlines, 1);
+            STATS_ADD(active_edges_sum, used[0] + used[1]);
+            STATS_MAX(active_edges_max, used[0] + used[1]);
+#endif
+            
+            // Algorithm 3-3, 3-4
+            if (used[0] && used[1])
+            {
+#ifdef SCANLINE_STATS
+                filled = 1;
+#endif
+                if (slots[0].x <= slots[1].x)
+                    rast1_fill_span(scanline, canvas->w, slots[0].x, slots[1].x, max_weight);
+                else
+                    rast1_fill_span(scanline, canvas->w, slots[1].x, slots[0].x, max_weight);
+            }
             
             ++y;
         }
         
-        memcpy(canvas->p + j * stride, scanline, canvas->w);
+#ifdef SCANLINE_STATS
+        STATS_ADD(rows_processed, filled);
+        STATS_ADD(rows_skipped, !filled);
+#endif
         ++j;
+        
+        if (j % RAST1_TRACE_BAND == 0 || j == canvas->h)
+            TRACE_END(trace_band);
+    }
+}
+
+/*
+* NOTE(chan) : Fast path for EDGE_SHAPE_RECTILINEAR (rectangles, bars, panels).
+* All the edges are vertical, so dx is 0 and an active edge never moves.
+* The active list only changes where an edge starts or ends.
+* Between those y values every scanline is the same, so once a row saw
+* the same active list on all of its subsamples, the following rows are copied
+* from it until the next edge starts or ends. Only the boundary rows run the sweep,
+* and the boundary columns get their fractional coverage from rast1_fill_span as usual.
+* Therefore the result is the same as canvas_rasterize1_sorted_edges.
+*/
+static void rast1_rectilinear(Canvas* canvas, Edge* e, int edge_count, int vsubsample, FillRule rule)
+{
+    Heap* hh = &g_rast1_scratch.heap;
+    size_t stride = (size_t)canvas->w * canvas->comp;
+    int j = 0;
+    int y = 0;
+    int max_weight = (255 / vsubsample);
+    int s;
+    ActiveEdge* active = NULL;
+    Edge* sentinel = e + edge_count;
+    TRACE_DECL(trace_rasterize);
+    
+    if (canvas->tiles)
+    {
+        canvas_rasterize1_sorted_edges_fill_rule(canvas, e, edge_count, vsubsample, rule);
+        return;
     }
     
-    heap_cleanup(&hh);
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    // NOTE(chan) : the rows are copied in runs, so this path is traced as a whole instead of in bands.
+    TRACE_BEGIN(trace_rasterize, "rasterize rectilinear");
     
-    free(scanline);
+    while(j < canvas->h)
+    {
+        uint8_t* row = canvas->p + (size_t)j * stride;
+        int uniform = 1; // the active list was the same on all the subsamples of this row
+        float next_event;
+        ActiveEdge* z;
+#ifdef SCANLINE_STATS
+        int filled = 0;
+#endif
+        
+        memset(row, 0, canvas->w);
+        for(s = 0; s < vsubsample; ++s)
+        {
+            float scan_y = y + 0.5f;
+            
+            if (s > 0)
+            {
+                if (e != sentinel && e->y0 <= scan_y)
+                    uniform = 0;
+                for(z = active; z && uniform; z = z->next)
+                    if (z->ey <= scan_y)
+                        uniform = 0;
+            }
+            
+            rast1_update_active(hh, &active, &e, sentinel, scan_y);
+            
+            if (active)
+            {
+                rast1_fill_active(row, canvas->w, active, max_weight, rule);
+#ifdef SCANLINE_STATS
+                filled = 1;
+#endif
+            }
+            
+            ++y;
+        }
+        ++j;
+        
+#ifdef SCANLINE_STATS
+        STATS_ADD(rows_processed, filled);
+        STATS_ADD(rows_skipped, !filled);
+#endif
+        
+        if (!uniform)
+            continue;
+        
+        // the first y where the active list changes
+        next_event = e != sentinel ? e->y0 : (float)(canvas->h * vsubsample) + 1.f;
+        for(z = active; z; z = z->next)
+            if (z->ey < next_event)
+                next_event = z->ey;
+        
+        // copy this row while the last subsample of the next row is before the change
+        while(j < canvas->h && (y + vsubsample - 1) + 0.5f < next_event)
+        {
+            memcpy(canvas->p + (size_t)j * stride, row, canvas->w);
+            y += vsubsample;
+            ++j;
+            STATS_ADD(rows_skipped, 1);
+        }
+    }
+    
+    rast1_release_active(hh, active);
+    TRACE_END(trace_rasterize);
+}
+
+// rast1_rectilinear with the non-zero rule, the edges must be EDGE_SHAPE_RECTILINEAR
+void canvas_rasterize1_sorted_edges_rectilinear(Canvas* canvas, Edge* e, int edge_count, int vsubsample)
+{
+    rast1_rectilinear(canvas, e, edge_count, vsubsample, FILL_NONZERO);
+}
+
+/*
+* NOTE(chan) : The fill rule doesn't matter for the convex path,
+* because a convex polygon never crosses itself and its winding number is 0 or 1.
+*/
+void canvas_rasterize1_sorted_edges_with_info_fill_rule(Canvas* canvas, Edge* e, int edge_count, int vsubsample, EdgeInfo* info, FillRule rule)
+{
+    if (info && (info->flags & EDGE_SHAPE_RECTILINEAR))
+        rast1_rectilinear(canvas, e, edge_count, vsubsample, rule);
+    else if (info && (info->flags & EDGE_SHAPE_CONVEX))
+        canvas_rasterize1_sorted_edges_convex(canvas, e, edge_count, vsubsample);
+    else
+        canvas_rasterize1_sorted_edges_fill_rule(canvas, e, edge_count, vsubsample, rule);
+}
+
+/*
+* NOTE(chan) : Pick the rasterizer with the EdgeInfo from edges_alloc_for_raster_from_polygon.
+*/
+void canvas_rasterize1_sorted_edges_with_info(Canvas* canvas, Edge* e, int edge_count, int vsubsample, EdgeInfo* info)
+{
+    canvas_rasterize1_sorted_edges_with_info_fill_rule(canvas, e, edge_count, vsubsample, info, FILL_NONZERO);
 }
\ No newline at end of file
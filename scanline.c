@@ -0,0 +1,53 @@
+/*
+* NOTE(chan) : Unity build. Every program (main.c, bench.c) includes this file,
+* which includes all the other source files.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "def.h"
+#ifdef SCANLINE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define STBIW_MALLOC(size) SCANLINE_MALLOC(size)
+#define STBIW_REALLOC(p, size) SCANLINE_REALLOC(p, size)
+#define STBIW_FREE(p) SCANLINE_FREE(p)
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "platform.c"
+#include "stats.c"
+#include "trace.c"
+#include "heap.c"
+#include "canvas.c"
+#include "png.c"
+#include "edge.c"
+#include "rasterize1.c"
+#include "lcd.c"
+#include "sdf.c"
+#include "primitive.c"
+#include "paint.c"
+#include "scene.c"
+#include "clip.c"
+#include "jobs.c"
+#include "async.c"
+#include "batch.c"
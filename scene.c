@@ -0,0 +1,622 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Scene rendering, N colored shapes in one sweep.
+* A shape has a solid color, or a gradient or an image paint (scene_add_polygon_paint).
+*     Scene scene;
+*     scene_init(&scene, 5);
+*     scene_add_polygon(&scene, &sea, 1.f, 1.f, 0.f, 0.f, 0, FILL_NONZERO, blue);
+*     scene_add_polygon(&scene, &land, 1.f, 1.f, 0.f, 0.f, 0, FILL_EVEN_ODD, green); // painted over the sea
+*     scene_render(&scene, canvas);
+*     scene_free(&scene);
+* Drawing the shapes one by one sweeps the canvas once per shape.
+* Here the active list holds the edges of every shape, sorted by x as usual,
+* and every shape keeps its own winding number while the list is walked.
+* So each shape gets its own coverage row, but only the shapes that cover something on the row
+* have one (a slot), and only their span [x0, x1] is composited and cleared.
+* The slots of a row are composited in the shape order over the canvas row, which is the background.
+*
+* Occlusion (Scene.occlusion). In a deep scene most of the fill goes to pixels that a shape in front paints over.
+* So the spans of a row are only recorded during the sweep, and filled front to back at the end of the row.
+* The pixels that a shape covers completely go into a span list of opaque intervals,
+* and the shapes behind skip them (rast1_fill_span_occluded). The composite is still back to front,
+* and an opaque pixel gives the color of its shape whatever is under it, so the image doesn't change.
+* A pixel is opaque at coverage 255, which needs 255 % vsubsample == 0 (1, 3, 5, 15, 17...).
+* With the other subsample counts the coverage never gets there, and the spans are filled right away.
+*
+* Incremental render. When a shape moves (scene_set_polygon), only the rect it left and the rect it goes to change.
+*     scene_set_polygon(&scene, id, &needle, 1.f, 1.f, x, y, 0);
+*     scene_render_dirty(&scene, canvas, background); // repaints the dirty rects of the canvas
+*     canvas_save_png_cached(canvas, "frame.png", NULL, 0, &cache); // encodes the strips under them
+* A dirty rect is reset to the background and swept from its first row, with only its columns filled and composited :
+* the rows outside are never swept, and the columns outside are given as opaque intervals to the fill.
+*/
+
+typedef struct SceneSpan
+{
+    int x0, x1; // fixed point
+    int next; // the next span of the same slot, or -1
+} SceneSpan;
+
+typedef struct SceneRow
+{
+    int* slot; // per shape, the coverage slot on this row or -1
+    int* winding; // per shape, the winding number (or the parity) on the current scanline
+    int* x0; // per shape, the fixed point x where the shape went inside
+    int* touched; // the shapes with a slot
+    int touched_count;
+    uint8_t* cover; // slot_capacity rows of w
+    int* span_x0; // per slot, the pixels to composite
+    int* span_x1;
+    int slot_capacity;
+    int w;
+    
+    int record; // the spans are filled at the end of the row, front to back
+    SceneSpan* spans;
+    int span_count, span_capacity;
+    int* span_head; // per slot, the first recorded span or -1
+    int* opaque; // the span list of the opaque pixels, see rast1_fill_span_occluded
+    int opaque_count;
+    int* opaque_merge; // the next opaque list
+    int* runs; // the opaque runs of the current shape
+    uint8_t* rgb; // the colors of a run of a gradient or an image paint
+    int clip_x0, clip_x1; // the columns to fill and composite
+} SceneRow;
+
+void scene_init(Scene* scene, int vsubsample)
+{
+    memset(scene, 0, sizeof(*scene));
+    scene->vsubsample = vsubsample;
+    scene->occlusion = 1;
+}
+
+void scene_free(Scene* scene)
+{
+    SCANLINE_FREE(scene->shapes);
+    SCANLINE_FREE(scene->edges);
+    memset(scene, 0, sizeof(*scene));
+}
+
+// removes the shapes and keeps the memory, for the next frame
+void scene_clear(Scene* scene)
+{
+    scene->shape_count = 0;
+    scene->edge_count = 0;
+    scene->sorted = 0;
+}
+
+// the edges of the polygon as the edges of the shape id, and its rect
+static void scene_add_edges(Scene* scene, int id, Polygon* polygon, float scale_x, float scale_y, float shift_x, float shift_y, int invert)
+{
+    int count;
+    EdgeInfo info;
+    Edge* edges = edges_alloc_for_raster_from_polygon(polygon, scale_x, scale_y, shift_x, shift_y, invert, scene->vsubsample, &count, &info);
+    
+    if (scene->edge_count + count + 1 > scene->edge_capacity) // + 1 for the sentinel
+    {
+        while(scene->edge_count + count + 1 > scene->edge_capacity)
+            scene->edge_capacity = scene->edge_capacity ? scene->edge_capacity * 2 : 64;
+        scene->edges = (Edge*)SCANLINE_REALLOC(scene->edges, sizeof(Edge) * scene->edge_capacity);
+    }
+    for(int i = 0; i < count; ++i)
+    {
+        edges[i].shape = id;
+        scene->edges[scene->edge_count + i] = edges[i];
+    }
+    scene->edge_count += count;
+    scene->sorted = 0;
+    scene->shapes[id].rect = canvas_rect_from_info(&info);
+    scene->shapes[id].changed = 1;
+    
+    edges_free(edges);
+}
+
+// scene_add_polygon with a gradient or an image paint (paint.c), the paint is copied
+int scene_add_polygon_paint(Scene* scene, Polygon* polygon, float scale_x, float scale_y, float shift_x, float shift_y, int invert, FillRule rule, const Paint* paint)
+{
+    int id = scene->shape_count;
+    CanvasRect none = { 0, 0, 0, 0 };
+    
+    if (scene->shape_count == scene->shape_capacity)
+    {
+        scene->shape_capacity = scene->shape_capacity ? scene->shape_capacity * 2 : 16;
+        scene->shapes = (SceneShape*)SCANLINE_REALLOC(scene->shapes, sizeof(SceneShape) * scene->shape_capacity);
+    }
+    scene->shapes[id].paint = *paint;
+    scene->shapes[id].rule = rule;
+    scene->shapes[id].rendered = none;
+    ++scene->shape_count;
+    
+    scene_add_edges(scene, id, polygon, scale_x, scale_y, shift_x, shift_y, invert);
+    return id;
+}
+
+/*
+* Adds a shape on top of the ones added before, with the transform of edges_alloc_for_raster_from_polygon.
+* Returns the shape id, which is the paint order.
+*/
+int scene_add_polygon(Scene* scene, Polygon* polygon, float scale_x, float scale_y, float shift_x, float shift_y, int invert, FillRule rule, CanvasColor color)
+{
+    Paint paint = paint_solid(color);
+    return scene_add_polygon_paint(scene, polygon, scale_x, scale_y, shift_x, shift_y, invert, rule, &paint);
+}
+
+/*
+* Replaces the polygon of the shape id, it keeps its paint and its place in the paint order.
+* scene_render_dirty repaints the rect it had and the rect it has now.
+*/
+void scene_set_polygon(Scene* scene, int id, Polygon* polygon, float scale_x, float scale_y, float shift_x, float shift_y, int invert)
+{
+    int count = 0;
+    for(int i = 0; i < scene->edge_count; ++i)
+    {
+        if (scene->edges[i].shape != id)
+            scene->edges[count++] = scene->edges[i];
+    }
+    scene->edge_count = count;
+    scene_add_edges(scene, id, polygon, scale_x, scale_y, shift_x, shift_y, invert);
+}
+
+static uint8_t* scene_row_slot(SceneRow* row, int shape)
+{
+    int slot = row->slot[shape];
+    if (slot < 0)
+    {
+        slot = row->touched_count;
+        if (slot == row->slot_capacity)
+        {
+            row->slot_capacity *= 2;
+            row->cover = (uint8_t*)SCANLINE_REALLOC(row->cover, (size_t)row->slot_capacity * row->w);
+            row->span_x0 = (int*)SCANLINE_REALLOC(row->span_x0, sizeof(int) * row->slot_capacity);
+            row->span_x1 = (int*)SCANLINE_REALLOC(row->span_x1, sizeof(int) * row->slot_capacity);
+            row->span_head = (int*)SCANLINE_REALLOC(row->span_head, sizeof(int) * row->slot_capacity);
+            memset(row->cover + (size_t)slot * row->w, 0, (size_t)(row->slot_capacity - slot) * row->w);
+        }
+        row->slot[shape] = slot;
+        row->touched[row->touched_count++] = shape;
+        row->span_x0[slot] = row->w;
+        row->span_x1[slot] = -1;
+        row->span_head[slot] = -1;
+    }
+    return row->cover + (size_t)slot * row->w;
+}
+
+static void scene_row_span(SceneRow* row, int shape, int x0, int x1, int max_weight)
+{
+    int i = x0 >> RAST1_FIXSHIFT;
+    int j = x1 >> RAST1_FIXSHIFT;
+    uint8_t* cover;
+    int slot;
+    
+    if (i >= row->w || j < 0)
+        return;
+    
+    cover = scene_row_slot(row, shape);
+    slot = row->slot[shape];
+    if (row->record)
+    {
+        SceneSpan* span;
+        if (row->span_count == row->span_capacity)
+        {
+            row->span_capacity *= 2;
+            row->spans = (SceneSpan*)SCANLINE_REALLOC(row->spans, sizeof(SceneSpan) * row->span_capacity);
+        }
+        span = row->spans + row->span_count;
+        span->x0 = x0;
+        span->x1 = x1;
+        span->next = row->span_head[slot];
+        row->span_head[slot] = row->span_count++;
+    }
+    else
+        rast1_fill_span(cover, row->w, x0, x1, max_weight);
+    
+    if (i < 0) i = 0;
+    if (j >= row->w) j = row->w - 1;
+    if (i < row->span_x0[slot]) row->span_x0[slot] = i;
+    if (j > row->span_x1[slot]) row->span_x1[slot] = j;
+}
+
+// rast1_fill_active with a winding number per shape
+static void scene_fill_active(Scene* scene, SceneRow* row, ActiveEdge* active, int max_weight)
+{
+    for(ActiveEdge* e = active; e; e = e->next)
+    {
+        int s = e->shape;
+        if (scene->shapes[s].rule == FILL_EVEN_ODD)
+        {
+            if (row->winding[s] == 0)
+                row->x0[s] = e->x;
+            else
+                scene_row_span(row, s, row->x0[s], e->x, max_weight);
+            row->winding[s] ^= 1;
+        }
+        else
+        {
+            int w = row->winding[s];
+            if (w == 0)
+                row->x0[s] = e->x;
+            w += e->direction;
+            if (w == 0)
+                scene_row_span(row, s, row->x0[s], e->x, max_weight);
+            row->winding[s] = w;
+        }
+    }
+    
+    // a closed shape is back to 0 here, reset anyway so a broken one can't leak into the next scanline
+    for(ActiveEdge* e = active; e; e = e->next)
+        row->winding[e->shape] = 0;
+}
+
+// the paint order, the slots were taken in the order the shapes were met
+static void scene_row_sort(SceneRow* row)
+{
+    for(int i = 1; i < row->touched_count; ++i)
+    {
+        int t = row->touched[i];
+        int j = i;
+        while(j > 0 && row->touched[j - 1] > t)
+        {
+            row->touched[j] = row->touched[j - 1];
+            --j;
+        }
+        row->touched[j] = t;
+    }
+}
+
+// adds the pixels of cover[x0, x1] at 255 to the opaque span list
+static void scene_row_add_opaque(SceneRow* row, const uint8_t* cover, int x0, int x1)
+{
+    int run_count = 0, count = 0;
+    int a = 0, b = 0;
+    
+    for(int x = x0; x <= x1; ++x)
+    {
+        if (cover[x] != 255)
+            continue;
+        row->runs[2 * run_count] = x;
+        while(x <= x1 && cover[x] == 255)
+            ++x;
+        row->runs[2 * run_count + 1] = x;
+        ++run_count;
+    }
+    if (run_count == 0)
+        return;
+    
+    // merge the two sorted lists, joining the intervals that touch
+    while(a < row->opaque_count || b < run_count)
+    {
+        const int* next;
+        if (b == run_count || (a < row->opaque_count && row->opaque[2 * a] < row->runs[2 * b]))
+            next = row->opaque + 2 * a++;
+        else
+            next = row->runs + 2 * b++;
+        
+        if (count && next[0] <= row->opaque_merge[2 * count - 1])
+        {
+            if (next[1] > row->opaque_merge[2 * count - 1])
+                row->opaque_merge[2 * count - 1] = next[1];
+        }
+        else
+        {
+            row->opaque_merge[2 * count] = next[0];
+            row->opaque_merge[2 * count + 1] = next[1];
+            ++count;
+        }
+    }
+    
+    {
+        int* t = row->opaque;
+        row->opaque = row->opaque_merge;
+        row->opaque_merge = t;
+        row->opaque_count = count;
+    }
+}
+
+// fills the recorded spans front to back, the shapes skip what the shapes in front made opaque
+static void scene_resolve_row(SceneRow* row, int max_weight)
+{
+    scene_row_sort(row);
+    
+    // the columns out of the window are hidden from the start
+    row->opaque_count = 0;
+    if (row->clip_x0 > 0)
+    {
+        row->opaque[2 * row->opaque_count] = 0;
+        row->opaque[2 * row->opaque_count + 1] = row->clip_x0;
+        ++row->opaque_count;
+    }
+    if (row->clip_x1 < row->w)
+    {
+        row->opaque[2 * row->opaque_count] = row->clip_x1;
+        row->opaque[2 * row->opaque_count + 1] = row->w;
+        ++row->opaque_count;
+    }
+    
+    for(int i = row->touched_count - 1; i >= 0; --i)
+    {
+        int slot = row->slot[row->touched[i]];
+        uint8_t* cover = row->cover + (size_t)slot * row->w;
+        int k;
+        
+        // trim the ends of the slot that are hidden, so the composite and the clear skip them too
+        k = rast1_opaque_find(row->opaque, row->opaque_count, row->span_x0[slot]);
+        if (k < row->opaque_count && row->opaque[2 * k] <= row->span_x0[slot])
+            row->span_x0[slot] = row->opaque[2 * k + 1];
+        k = rast1_opaque_find(row->opaque, row->opaque_count, row->span_x1[slot]);
+        if (k < row->opaque_count && row->opaque[2 * k] <= row->span_x1[slot])
+            row->span_x1[slot] = row->opaque[2 * k] - 1;
+        if (row->span_x1[slot] < row->span_x0[slot])
+            continue; // hidden as a whole
+        
+        for(k = row->span_head[slot]; k >= 0; k = row->spans[k].next)
+            rast1_fill_span_occluded(cover, row->w, row->spans[k].x0, row->spans[k].x1, max_weight, row->opaque, row->opaque_count);
+        if (i > 0) // nothing is behind the last one
+            scene_row_add_opaque(row, cover, row->span_x0[slot], row->span_x1[slot]);
+    }
+    row->span_count = 0;
+}
+
+// source over of count pixels of one shape, dst and cover are at the pixel x
+static void scene_blend_span(const Paint* paint, uint8_t* dst, int comp, const uint8_t* cover, int x, int count, int y, uint8_t* rgb)
+{
+    CanvasColor color = paint->color;
+    
+    if (paint->type != PAINT_SOLID)
+        paint_blend_row(paint, dst, comp, cover, x, count, y, rgb);
+    else if (comp == 1)
+    {
+        int gray = (color.r * 77 + color.g * 150 + color.b * 29) >> 8;
+        for(int i = 0; i < count; ++i)
+        {
+            int a = cover[i];
+            if (a == 0)
+                continue;
+            dst[i] = (uint8_t)((dst[i] * (255 - a) + gray * a + 127) / 255);
+        }
+    }
+    else
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            int a = cover[i];
+            uint8_t* p = dst + (size_t)i * comp;
+            if (a == 0)
+                continue;
+            p[0] = (uint8_t)((p[0] * (255 - a) + color.r * a + 127) / 255);
+            p[1] = (uint8_t)((p[1] * (255 - a) + color.g * a + 127) / 255);
+            p[2] = (uint8_t)((p[2] * (255 - a) + color.b * a + 127) / 255);
+        }
+    }
+}
+
+/*
+* Source over of the slots in the shape order, then the slots are cleared for the next row.
+* A span is blended in the contiguous runs of the canvas, one per tile on a tiled canvas.
+*/
+static void scene_composite_row(Scene* scene, SceneRow* row, Canvas* canvas, int y)
+{
+    scene_row_sort(row);
+    
+    for(int i = 0; i < row->touched_count; ++i)
+    {
+        int shape = row->touched[i];
+        int slot = row->slot[shape];
+        uint8_t* cover = row->cover + (size_t)slot * row->w;
+        const Paint* paint = &scene->shapes[shape].paint;
+        int x1 = row->span_x1[slot];
+        int x = row->span_x0[slot] > row->clip_x0 ? row->span_x0[slot] : row->clip_x0;
+        int end = x1 < row->clip_x1 - 1 ? x1 : row->clip_x1 - 1;
+        
+        while(x <= end)
+        {
+            int count = canvas_row_span(canvas, x);
+            uint8_t* p = canvas_pixel(canvas, x, y);
+            if (count > end + 1 - x)
+                count = end + 1 - x;
+            if (p)
+                scene_blend_span(paint, p, canvas->comp, cover + x, x, count, y, row->rgb);
+            x += count;
+        }
+        
+        if (x1 >= row->span_x0[slot])
+            memset(cover + row->span_x0[slot], 0, x1 - row->span_x0[slot] + 1);
+        row->slot[shape] = -1;
+    }
+    row->touched_count = 0;
+}
+
+static void scene_row_init(Scene* scene, SceneRow* row, int w)
+{
+    int max_weight = 255 / scene->vsubsample;
+    
+    memset(row, 0, sizeof(*row));
+    row->w = w;
+    row->slot = (int*)SCANLINE_MALLOC(sizeof(int) * scene->shape_count * 4);
+    row->winding = row->slot + scene->shape_count;
+    row->x0 = row->winding + scene->shape_count;
+    row->touched = row->x0 + scene->shape_count;
+    for(int i = 0; i < scene->shape_count; ++i)
+    {
+        row->slot[i] = -1;
+        row->winding[i] = 0;
+    }
+    row->slot_capacity = 4;
+    row->cover = (uint8_t*)SCANLINE_MALLOC((size_t)row->slot_capacity * row->w);
+    row->span_x0 = (int*)SCANLINE_MALLOC(sizeof(int) * row->slot_capacity);
+    row->span_x1 = (int*)SCANLINE_MALLOC(sizeof(int) * row->slot_capacity);
+    memset(row->cover, 0, (size_t)row->slot_capacity * row->w);
+    row->span_head = (int*)SCANLINE_MALLOC(sizeof(int) * row->slot_capacity);
+    row->rgb = (uint8_t*)SCANLINE_MALLOC((size_t)row->w * 3);
+    row->record = scene->occlusion && max_weight * scene->vsubsample == 255;
+    if (row->record)
+    {
+        row->span_capacity = 256;
+        row->spans = (SceneSpan*)SCANLINE_MALLOC(sizeof(SceneSpan) * row->span_capacity);
+        // at most (w + 1) / 2 intervals in a row
+        row->opaque = (int*)SCANLINE_MALLOC(sizeof(int) * (row->w + 2));
+        row->opaque_merge = (int*)SCANLINE_MALLOC(sizeof(int) * (row->w + 2));
+        row->runs = (int*)SCANLINE_MALLOC(sizeof(int) * (row->w + 2));
+    }
+}
+
+static void scene_row_free(SceneRow* row)
+{
+    SCANLINE_FREE(row->slot);
+    SCANLINE_FREE(row->cover);
+    SCANLINE_FREE(row->span_x0);
+    SCANLINE_FREE(row->span_x1);
+    SCANLINE_FREE(row->span_head);
+    SCANLINE_FREE(row->rgb);
+    SCANLINE_FREE(row->spans);
+    SCANLINE_FREE(row->opaque);
+    SCANLINE_FREE(row->opaque_merge);
+    SCANLINE_FREE(row->runs);
+}
+
+// the sweep of the rows of rect, composited over the columns of rect
+static void scene_sweep(Scene* scene, SceneRow* row, Canvas* canvas, CanvasRect rect)
+{
+    Heap hh = {0};
+    ActiveEdge* active = NULL;
+    Edge* e = scene->edges;
+    Edge* sentinel = scene->edges + scene->edge_count;
+    int vsubsample = scene->vsubsample;
+    int max_weight = 255 / vsubsample;
+    int y = rect.y0 * vsubsample;
+    
+    row->clip_x0 = rect.x0;
+    row->clip_x1 = rect.x1;
+    
+    for(int j = rect.y0; j < rect.y1; ++j)
+    {
+        for(int s = 0; s < vsubsample; ++s)
+        {
+            rast1_update_active(&hh, &active, &e, sentinel, y + 0.5f);
+            if (active)
+                scene_fill_active(scene, row, active, max_weight);
+            ++y;
+        }
+        
+        if (row->touched_count && row->record)
+            scene_resolve_row(row, max_weight);
+        if (row->touched_count)
+            scene_composite_row(scene, row, canvas, j);
+        
+        // nothing is left to draw below the last edge
+        if (active == NULL && e == sentinel)
+            break;
+    }
+    
+    heap_cleanup(&hh);
+}
+
+static void scene_sort(Scene* scene)
+{
+    if (!scene->sorted)
+    {
+        edges_sort(scene->edges, scene->edge_count);
+        scene->sorted = 1;
+    }
+}
+
+/*
+* Composites every shape over the canvas (1 component for gray, 3 or 4 for RGB).
+* The edges are sorted on the first render after a change, so a static scene can be rendered again for free.
+* The rects of the shapes are marked dirty on the canvas.
+*/
+void scene_render(Scene* scene, Canvas* canvas)
+{
+    SceneRow row;
+    CanvasRect all = { 0, 0, canvas->w, canvas->h };
+    TRACE_DECL(trace_scene);
+    
+    if (scene->shape_count == 0)
+        return;
+    
+    TRACE_BEGIN_ARG(trace_scene, "scene render", scene->shape_count);
+    
+    scene_sort(scene);
+    scene_row_init(scene, &row, canvas->w);
+    scene_sweep(scene, &row, canvas, all);
+    scene_row_free(&row);
+    
+    for(int i = 0; i < scene->shape_count; ++i)
+    {
+        SceneShape* shape = scene->shapes + i;
+        canvas_mark_dirty(canvas, shape->rect);
+        shape->rendered = shape->rect;
+        shape->changed = 0;
+    }
+    
+    TRACE_END(trace_scene);
+}
+
+/*
+* Repaints the dirty rects of the canvas after the changes of the shapes since the last render :
+* the rects are marked dirty, then every dirty rect is filled with background and the scene is composited over it.
+* The canvas must hold this scene over background everywhere else. The dirty list is kept for canvas_save_png_cached,
+* call canvas_clear_dirty if nothing consumes it.
+*/
+void scene_render_dirty(Scene* scene, Canvas* canvas, CanvasColor background)
+{
+    SceneRow row;
+    uint8_t gray = (uint8_t)((background.r * 77 + background.g * 150 + background.b * 29) >> 8);
+    TRACE_DECL(trace_scene);
+    
+    for(int i = 0; i < scene->shape_count; ++i)
+    {
+        SceneShape* shape = scene->shapes + i;
+        if (!shape->changed)
+            continue;
+        canvas_mark_dirty(canvas, shape->rendered);
+        canvas_mark_dirty(canvas, shape->rect);
+        shape->rendered = shape->rect;
+        shape->changed = 0;
+    }
+    
+    TRACE_BEGIN_ARG(trace_scene, "scene render dirty", canvas->dirty_count);
+    
+    // the background
+    for(int i = 0; i < canvas->dirty_count; ++i)
+    {
+        CanvasRect r = canvas->dirty[i];
+        for(int y = r.y0; y < r.y1; ++y)
+        {
+            for(int x = r.x0; x < r.x1;)
+            {
+                int count = canvas_row_span(canvas, x);
+                uint8_t* p = canvas_pixel(canvas, x, y);
+                if (count > r.x1 - x)
+                    count = r.x1 - x;
+                if (p == NULL) // the tile can't be allocated
+                {
+                    x += count;
+                    continue;
+                }
+                if (canvas->comp == 1)
+                    memset(p, gray, count);
+                else
+                {
+                    for(int k = 0; k < count; ++k, p += canvas->comp)
+                    {
+                        p[0] = background.r;
+                        p[1] = background.g;
+                        p[2] = background.b;
+                    }
+                }
+                x += count;
+            }
+        }
+    }
+    
+    if (scene->shape_count)
+    {
+        scene_sort(scene);
+        scene_row_init(scene, &row, canvas->w);
+        for(int i = 0; i < canvas->dirty_count; ++i)
+            scene_sweep(scene, &row, canvas, canvas->dirty[i]);
+        scene_row_free(&row);
+    }
+    
+    TRACE_END(trace_scene);
+}
@@ -0,0 +1,350 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Signed distance field from the edge array, like stbtt_GetGlyphSDF.
+* Each pixel stores onedge_value + pixel_dist_scale * d,
+* where d is the distance from the pixel center to the nearest edge,
+* positive inside the polygon and negative outside.
+* The inside test is the same non-zero winding rule as rast1_fill_active.
+* 
+* A pixel farther than max_dist from every edge is just 0 or 255,
+* so an edge only matters to the pixels within max_dist of it.
+* Two acceleration structures avoid testing every edge on every pixel:
+* - a uniform grid of SDF_CELL_SIZE cells. Each cell lists the edges within max_dist of it,
+*   so a pixel only measures the distance to the edges of its cell.
+* - a bucket per row. Each row lists the edges crossing the center of the row,
+*   so the winding of a row is found with a sweep over its crossings.
+* Both are stored as one index array with the start offset of each cell / row.
+* After they are built, every row is independent, so the rows run in parallel.
+* 
+* The edges should come from edges_alloc_for_sdf_from_polygon, which keeps the horizontal edges.
+* The edges don't need to be sorted.
+*/
+#define SDF_CELL_SHIFT 4
+#define SDF_CELL_SIZE (1 << SDF_CELL_SHIFT)
+
+typedef struct SdfCrossing
+{
+    float x;
+    int direction;
+} SdfCrossing;
+
+typedef struct SdfContext
+{
+    Canvas* canvas;
+    Edge* edges;
+    float onedge_value;
+    float pixel_dist_scale;
+    float max_dist;
+    
+    int cells_x, cells_y;
+    int* cell_start; // cells_x * cells_y + 1 offsets into cell_edges
+    int* cell_edges;
+    
+    int* row_start; // canvas->h + 1 offsets into row_edges
+    int* row_edges;
+    int max_row_edges;
+    volatile int failed; // the bands that couldn't allocate their crossings
+} SdfContext;
+
+/*
+* Clip the segment to y in [ya, yb] and return the x range of the clipped part.
+* Return 0 if the segment doesn't reach the band.
+*/
+static int sdf_clip_segment_x(Edge* e, float ya, float yb, float* out_x_min, float* out_x_max)
+{
+    float dy = e->y1 - e->y0;
+    float t0 = 0.f, t1 = 1.f;
+    float xa, xb;
+    
+    if (dy == 0.f)
+    {
+        if (e->y0 < ya || e->y0 > yb)
+            return 0;
+    }
+    else
+    {
+        // NOTE(chan) : edges always have y0 <= y1, so dy is positive here.
+        float ta = (ya - e->y0) / dy;
+        float tb = (yb - e->y0) / dy;
+        if (ta > t0) t0 = ta;
+        if (tb < t1) t1 = tb;
+        if (t0 > t1)
+            return 0;
+    }
+    
+    xa = e->x0 + (e->x1 - e->x0) * t0;
+    xb = e->x0 + (e->x1 - e->x0) * t1;
+    *out_x_min = xa < xb ? xa : xb;
+    *out_x_max = xa < xb ? xb : xa;
+    return 1;
+}
+
+/*
+* Visit the grid cells within max_dist of the edge.
+* If cell_edges is NULL, just count them in cell_start (shifted by one for the prefix sum).
+*/
+static void sdf_grid_add_edge(SdfContext* ctx, int edge_index, int* cell_fill)
+{
+    Edge* e = ctx->edges + edge_index;
+    float d = ctx->max_dist;
+    int cy, cy0, cy1;
+    
+    cy0 = IFLOOR((e->y0 - d) / SDF_CELL_SIZE);
+    cy1 = IFLOOR((e->y1 + d) / SDF_CELL_SIZE);
+    if (cy0 < 0) cy0 = 0;
+    if (cy1 > ctx->cells_y - 1) cy1 = ctx->cells_y - 1;
+    
+    for(cy = cy0; cy <= cy1; ++cy)
+    {
+        float x_min, x_max;
+        int cx, cx0, cx1;
+        float band_y0 = (float)(cy * SDF_CELL_SIZE) - d;
+        float band_y1 = (float)((cy + 1) * SDF_CELL_SIZE) + d;
+        
+        if (!sdf_clip_segment_x(e, band_y0, band_y1, &x_min, &x_max))
+            continue;
+        
+        cx0 = IFLOOR((x_min - d) / SDF_CELL_SIZE);
+        cx1 = IFLOOR((x_max + d) / SDF_CELL_SIZE);
+        if (cx0 < 0) cx0 = 0;
+        if (cx1 > ctx->cells_x - 1) cx1 = ctx->cells_x - 1;
+        
+        for(cx = cx0; cx <= cx1; ++cx)
+        {
+            int cell = cy * ctx->cells_x + cx;
+            if (cell_fill)
+                ctx->cell_edges[cell_fill[cell]++] = edge_index;
+            else
+                ++ctx->cell_start[cell + 1];
+        }
+    }
+}
+
+/*
+* The rows whose center is in [y0, y1), which is the same test as the active edge insertion.
+*/
+static void sdf_edge_rows(SdfContext* ctx, Edge* e, int* out_r0, int* out_r1)
+{
+    int r0 = (int)ceil(e->y0 - 0.5f);
+    int r1 = (int)ceil(e->y1 - 0.5f);
+    if (r0 < 0) r0 = 0;
+    if (r1 > ctx->canvas->h) r1 = ctx->canvas->h;
+    *out_r0 = r0;
+    *out_r1 = r1;
+}
+
+static void sdf_free(SdfContext* ctx)
+{
+    SCANLINE_FREE(ctx->cell_start);
+    SCANLINE_FREE(ctx->cell_edges);
+    SCANLINE_FREE(ctx->row_start);
+    SCANLINE_FREE(ctx->row_edges);
+    ctx->cell_start = ctx->cell_edges = ctx->row_start = ctx->row_edges = NULL;
+}
+
+// returns 0 if the grid or the row buckets can't be allocated, then nothing is left allocated
+static int sdf_build(SdfContext* ctx, int edge_count)
+{
+    int cell_count = ctx->cells_x * ctx->cells_y;
+    int h = ctx->canvas->h;
+    int* fill;
+    int i, r;
+    
+    ctx->cell_edges = ctx->row_start = ctx->row_edges = NULL;
+    
+    // grid : count, prefix sum, fill
+    ctx->cell_start = (int*)SCANLINE_MALLOC(sizeof(int) * (cell_count + 1));
+    if (ctx->cell_start == NULL)
+        return 0;
+    memset(ctx->cell_start, 0, sizeof(int) * (cell_count + 1));
+    for(i = 0; i < edge_count; ++i)
+        sdf_grid_add_edge(ctx, i, NULL);
+    for(i = 0; i < cell_count; ++i)
+        ctx->cell_start[i + 1] += ctx->cell_start[i];
+    
+    ctx->cell_edges = (int*)SCANLINE_MALLOC(sizeof(int) * (ctx->cell_start[cell_count] + 1));
+    fill = (int*)SCANLINE_MALLOC(sizeof(int) * (cell_count > h ? cell_count : h));
+    ctx->row_start = (int*)SCANLINE_MALLOC(sizeof(int) * (h + 1));
+    if (ctx->cell_edges == NULL || fill == NULL || ctx->row_start == NULL)
+    {
+        SCANLINE_FREE(fill);
+        sdf_free(ctx);
+        return 0;
+    }
+    memcpy(fill, ctx->cell_start, sizeof(int) * cell_count);
+    for(i = 0; i < edge_count; ++i)
+        sdf_grid_add_edge(ctx, i, fill);
+    
+    // row buckets : the same, with the rows each edge crosses
+    memset(ctx->row_start, 0, sizeof(int) * (h + 1));
+    for(i = 0; i < edge_count; ++i)
+    {
+        int r0, r1;
+        sdf_edge_rows(ctx, ctx->edges + i, &r0, &r1);
+        for(r = r0; r < r1; ++r)
+            ++ctx->row_start[r + 1];
+    }
+    
+    ctx->max_row_edges = 0;
+    for(r = 0; r < h; ++r)
+    {
+        int n = ctx->row_start[r + 1];
+        if (n > ctx->max_row_edges)
+            ctx->max_row_edges = n;
+        ctx->row_start[r + 1] += ctx->row_start[r];
+    }
+    
+    ctx->row_edges = (int*)SCANLINE_MALLOC(sizeof(int) * (ctx->row_start[h] + 1));
+    if (ctx->row_edges == NULL)
+    {
+        SCANLINE_FREE(fill);
+        sdf_free(ctx);
+        return 0;
+    }
+    memcpy(fill, ctx->row_start, sizeof(int) * h);
+    for(i = 0; i < edge_count; ++i)
+    {
+        int r0, r1;
+        sdf_edge_rows(ctx, ctx->edges + i, &r0, &r1);
+        for(r = r0; r < r1; ++r)
+            ctx->row_edges[fill[r]++] = i;
+    }
+    
+    SCANLINE_FREE(fill);
+    return 1;
+}
+
+static float sdf_segment_dist2(Edge* e, float px, float py)
+{
+    float ex = e->x1 - e->x0;
+    float ey = e->y1 - e->y0;
+    float vx = px - e->x0;
+    float vy = py - e->y0;
+    float len2 = ex * ex + ey * ey;
+    float t = len2 > 0.f ? (vx * ex + vy * ey) / len2 : 0.f;
+    
+    if (t < 0.f) t = 0.f;
+    else if (t > 1.f) t = 1.f;
+    
+    vx -= ex * t;
+    vy -= ey * t;
+    return vx * vx + vy * vy;
+}
+
+static void sdf_row(SdfContext* ctx, int y, SdfCrossing* crossings)
+{
+    Canvas* canvas = ctx->canvas;
+    uint8_t* dst = canvas->p + (size_t)canvas->w * canvas->comp * y;
+    float scan_y = y + 0.5f;
+    float max_dist2 = ctx->max_dist * ctx->max_dist;
+    int cell_row = (y >> SDF_CELL_SHIFT) * ctx->cells_x;
+    int crossing_count = 0;
+    int i, j, x, w = 0;
+    
+    // crossings of the row center, sorted by x
+    for(i = ctx->row_start[y]; i < ctx->row_start[y + 1]; ++i)
+    {
+        Edge* e = ctx->edges + ctx->row_edges[i];
+        SdfCrossing c;
+        c.x = e->x0 + (scan_y - e->y0) * (e->x1 - e->x0) / (e->y1 - e->y0);
+        c.direction = e->invert ? 1 : -1;
+        
+        j = crossing_count++;
+        while(j > 0 && crossings[j - 1].x > c.x)
+        {
+            crossings[j] = crossings[j - 1];
+            --j;
+        }
+        crossings[j] = c;
+    }
+    
+    j = 0;
+    for(x = 0; x < canvas->w; ++x)
+    {
+        float px = x + 0.5f;
+        float min_dist2 = max_dist2;
+        float dist, value;
+        int cell = cell_row + (x >> SDF_CELL_SHIFT);
+        
+        // non-zero winding of the ray from the pixel center to the left
+        while(j < crossing_count && crossings[j].x < px)
+            w += crossings[j++].direction;
+        
+        for(i = ctx->cell_start[cell]; i < ctx->cell_start[cell + 1]; ++i)
+        {
+            float d2 = sdf_segment_dist2(ctx->edges + ctx->cell_edges[i], px, scan_y);
+            if (d2 < min_dist2)
+                min_dist2 = d2;
+        }
+        
+        dist = sqrtf(min_dist2);
+        value = ctx->onedge_value + ctx->pixel_dist_scale * (w != 0 ? dist : -dist);
+        if (value < 0.f) value = 0.f;
+        else if (value > 255.f) value = 255.f;
+        dst[x] = (uint8_t)(value + 0.5f);
+    }
+}
+
+static void sdf_band(void* user, int band)
+{
+    SdfContext* ctx = (SdfContext*)user;
+    SdfCrossing* crossings = (SdfCrossing*)SCANLINE_MALLOC(sizeof(SdfCrossing) * (ctx->max_row_edges + 1));
+    int y0 = band << SDF_CELL_SHIFT;
+    int y1 = y0 + SDF_CELL_SIZE;
+    int y;
+    TRACE_DECL(trace_band);
+    
+    if (crossings == NULL)
+    {
+        atomic_fetch_add_int(&ctx->failed, 1);
+        return;
+    }
+    
+    TRACE_BEGIN_ARG(trace_band, "sdf band", y0);
+    if (y1 > ctx->canvas->h)
+        y1 = ctx->canvas->h;
+    for(y = y0; y < y1; ++y)
+        sdf_row(ctx, y, crossings);
+    
+    SCANLINE_FREE(crossings);
+    TRACE_END(trace_band);
+}
+
+/*
+* thread_count <= 0 uses all the hardware threads. Returns 0 if the canvas is tiled (the sdf needs canvas->p)
+* or the memory can't be allocated, then the canvas is left as it is or only some of its bands are written.
+*/
+int canvas_sdf_edges(Canvas* canvas, Edge* edges, int edge_count, float onedge_value, float pixel_dist_scale, int thread_count)
+{
+    SdfContext ctx;
+    int ok;
+    float far_value = onedge_value > 255.f - onedge_value ? onedge_value : 255.f - onedge_value;
+    TRACE_DECL(trace_build);
+    
+    assert(canvas->comp == 1);
+    assert(pixel_dist_scale > 0.f);
+    if (canvas->tiles) // the bands write canvas->p from the workers
+        return 0;
+    
+    ctx.canvas = canvas;
+    ctx.edges = edges;
+    ctx.onedge_value = onedge_value;
+    ctx.pixel_dist_scale = pixel_dist_scale;
+    ctx.max_dist = far_value / pixel_dist_scale + 1.f; // one more pixel so the clamped value is reached
+    ctx.cells_x = (canvas->w + SDF_CELL_SIZE - 1) >> SDF_CELL_SHIFT;
+    ctx.cells_y = (canvas->h + SDF_CELL_SIZE - 1) >> SDF_CELL_SHIFT;
+    ctx.failed = 0;
+    
+    TRACE_BEGIN(trace_build, "sdf build");
+    ok = sdf_build(&ctx, edge_count);
+    TRACE_END(trace_build);
+    if (!ok)
+        return 0;
+    
+    canvas_mark_dirty_rows(canvas, 0, canvas->h);
+    parallel_for(ctx.cells_y, thread_count, sdf_band, &ctx);
+    
+    sdf_free(&ctx);
+    return ctx.failed == 0;
+}
@@ -0,0 +1,18 @@
+#include "def.h"
+
+static SCANLINE_THREAD_LOCAL RasterStats g_raster_stats;
+
+void raster_stats_reset(void)
+{
+    memset(&g_raster_stats, 0, sizeof(g_raster_stats));
+}
+
+/*
+* NOTE(chan) : All zero if SCANLINE_STATS is not defined.
+*/
+RasterStats raster_stats_get(void)
+{
+    RasterStats stats = g_raster_stats;
+    stats.active_edges_avg = stats.scanlines ? (double)stats.active_edges_sum / (double)stats.scanlines : 0.0;
+    return stats;
+}
\ No newline at end of file
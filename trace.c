@@ -0,0 +1,105 @@
+#include "def.h"
+
+/*
+* NOTE(chan) : Every thread appends its events to its own buffer, so recording doesn't lock.
+* The buffers are linked into one list the first time a thread records,
+* and they live until the end of the program, so trace_dump sees the events
+* of the threads that already finished.
+*/
+static SCANLINE_THREAD_LOCAL TraceBuffer* g_trace_thread_buffer;
+static TraceBuffer* g_trace_buffers;
+static Mutex g_trace_mutex = MUTEX_STATIC_INIT;
+static int g_trace_next_tid = 1;
+static double g_trace_origin = -1.0;
+
+static TraceBuffer* trace_thread_buffer(void)
+{
+    TraceBuffer* b = g_trace_thread_buffer;
+    if (b == NULL)
+    {
+        b = (TraceBuffer*)SCANLINE_MALLOC(sizeof(TraceBuffer));
+        memset(b, 0, sizeof(*b));
+        
+        mutex_lock(&g_trace_mutex);
+        if (g_trace_origin < 0.0)
+            g_trace_origin = time_now();
+        b->tid = g_trace_next_tid++;
+        b->next = g_trace_buffers;
+        g_trace_buffers = b;
+        mutex_unlock(&g_trace_mutex);
+        
+        g_trace_thread_buffer = b;
+    }
+    return b;
+}
+
+void trace_begin(TraceScope* scope, const char* name, int arg)
+{
+    trace_thread_buffer(); // the first event sets the origin of the timestamps
+    scope->name = name;
+    scope->arg = arg;
+    scope->begin = time_now();
+}
+
+void trace_end(TraceScope* scope)
+{
+    double end = time_now();
+    TraceBuffer* b = trace_thread_buffer();
+    TraceEvent* ev;
+    
+    if (b->count == b->capacity)
+    {
+        int capacity = b->capacity ? b->capacity * 2 : 1024;
+        TraceEvent* events = (TraceEvent*)SCANLINE_REALLOC(b->events, sizeof(TraceEvent) * capacity);
+        if (events == NULL)
+            return;
+        b->events = events;
+        b->capacity = capacity;
+    }
+    
+    ev = b->events + b->count++;
+    ev->name = scope->name;
+    ev->begin = scope->begin;
+    ev->end = end;
+    ev->arg = scope->arg;
+}
+
+/*
+* Write the events recorded so far in the Chrome trace event format, and clear them.
+* Call it when the other threads are not recording.
+*/
+void trace_dump(const char* file_name)
+{
+    FILE* f = fopen(file_name, "w");
+    TraceBuffer* b;
+    int first = 1;
+    
+    if (f == NULL)
+    {
+        printf("Fail to write a trace on %s\n", file_name);
+        return;
+    }
+    
+    mutex_lock(&g_trace_mutex);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for(b = g_trace_buffers; b; b = b->next)
+    {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", first ? "" : ",\n", b->tid, b->tid);
+        first = 0;
+        
+        for(int i = 0; i < b->count; ++i)
+        {
+            TraceEvent* ev = b->events + i;
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    ev->name, b->tid, (ev->begin - g_trace_origin) * 1e6, (ev->end - ev->begin) * 1e6);
+            if (ev->arg >= 0)
+                fprintf(f, ",\"args\":{\"y\":%d}", ev->arg);
+            fprintf(f, "}");
+        }
+        b->count = 0;
+    }
+    fprintf(f, "\n]}\n");
+    mutex_unlock(&g_trace_mutex);
+    
+    fclose(f);
+}